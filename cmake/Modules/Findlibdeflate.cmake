@@ -0,0 +1,17 @@
+find_package(PkgConfig)
+pkg_check_modules(PC_libdeflate QUIET libdeflate)
+
+find_path(libdeflate_INCLUDE_DIR libdeflate.h
+          HINTS ${PC_libdeflate_INCLUDEDIR} ${PC_libdeflate_INCLUDE_DIRS})
+
+find_library(libdeflate_LIBRARY NAMES deflate
+             HINTS ${PC_libdeflate_LIBDIR} ${PC_libdeflate_LIBRARY_DIRS} )
+
+set(libdeflate_LIBRARIES ${libdeflate_LIBRARY})
+set(libdeflate_INCLUDE_DIRS ${libdeflate_INCLUDE_DIR})
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(libdeflate DEFAULT_MSG
+                                  libdeflate_LIBRARY libdeflate_INCLUDE_DIR)
+
+mark_as_advanced(libdeflate_INCLUDE_DIR libdeflate_LIBRARY )
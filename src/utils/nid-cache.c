@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#define HAVE_FILE_MMAP
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#include "nid-cache.h"
+#include "sha256.h"
+
+/* File layout: the magic and a version, then back to back records made of
+ * the NID (LE32), the key length (LE16) and the key bytes. A record cut
+ * short by an interrupted append is ignored. */
+#define NID_CACHE_MAGIC "VNIDCACH"
+#define NID_CACHE_VERSION 1
+#define NID_CACHE_HEADER_SIZE 12
+#define NID_CACHE_RECORD_SIZE 6
+#define NID_CACHE_MAX_KEY 0xFFFF
+
+typedef struct {
+	const uint8_t *key;	/* NULL for an empty slot */
+	uint32_t len;
+	uint32_t nid;
+	int owned;		/* key was allocated, not mapped from the file */
+} nid_cache_entry;
+
+typedef struct {
+	char *path;
+	nid_cache_mode mode;
+
+	uint8_t *map;
+	size_t map_size;
+
+	/* Open addressing, the capacity is a power of two kept at least twice the count */
+	nid_cache_entry *table;
+	size_t capacity;
+	size_t count;
+
+	/* Records for the new entries, appended to the file at close */
+	uint8_t *pending;
+	size_t pending_size;
+	size_t pending_capacity;
+
+	int mismatches;
+} nid_cache;
+
+static nid_cache *g_cache;
+
+static uint32_t hash_key(const uint8_t *prefix, size_t prefix_len, const uint8_t *msg, size_t len)
+{
+	uint32_t hash = 0x811c9dc5;
+	size_t i;
+
+	for (i = 0; i < prefix_len; i++)
+		hash = (hash ^ prefix[i]) * 0x01000193;
+	for (i = 0; i < len; i++)
+		hash = (hash ^ msg[i]) * 0x01000193;
+
+	return hash;
+}
+
+/* Slot holding prefix || msg, or the empty slot where it belongs */
+static nid_cache_entry *find_slot(nid_cache *cache, const uint8_t *prefix, size_t prefix_len,
+		const uint8_t *msg, size_t len)
+{
+	size_t mask = cache->capacity - 1;
+	size_t i = hash_key(prefix, prefix_len, msg, len) & mask;
+	nid_cache_entry *entry;
+
+	for (;; i = (i + 1) & mask) {
+		entry = &cache->table[i];
+		if (entry->key == NULL)
+			return entry;
+		if (entry->len == prefix_len + len
+				&& (prefix_len == 0 || memcmp(entry->key, prefix, prefix_len) == 0)
+				&& (len == 0 || memcmp(entry->key + prefix_len, msg, len) == 0))
+			return entry;
+	}
+}
+
+static int grow_table(nid_cache *cache)
+{
+	nid_cache_entry *old = cache->table;
+	size_t old_capacity = cache->capacity, i;
+
+	cache->capacity = old_capacity ? old_capacity * 2 : 1024;
+	cache->table = calloc(cache->capacity, sizeof(nid_cache_entry));
+	if (!cache->table) {
+		cache->table = old;
+		cache->capacity = old_capacity;
+		return -1;
+	}
+
+	for (i = 0; i < old_capacity; i++) {
+		if (old[i].key != NULL)
+			*find_slot(cache, NULL, 0, old[i].key, old[i].len) = old[i];
+	}
+
+	free(old);
+	return 0;
+}
+
+static int insert_entry(nid_cache *cache, const uint8_t *key, size_t len, uint32_t nid, int owned)
+{
+	nid_cache_entry *entry;
+
+	if ((cache->count + 1) * 2 > cache->capacity && grow_table(cache) < 0)
+		return -1;
+
+	entry = find_slot(cache, NULL, 0, key, len);
+	// first record wins, later duplicates come from tools racing on a name
+	if (entry->key != NULL)
+		return 0;
+
+	entry->key = key;
+	entry->len = len;
+	entry->nid = nid;
+	entry->owned = owned;
+	cache->count++;
+	return 1;
+}
+
+static int append_record(nid_cache *cache, const uint8_t *prefix, size_t prefix_len,
+		const uint8_t *msg, size_t len, uint32_t nid)
+{
+	size_t key_len = prefix_len + len;
+	uint8_t *key, *record;
+
+	if (key_len > NID_CACHE_MAX_KEY)
+		return 0;
+
+	if (cache->pending_size + NID_CACHE_RECORD_SIZE + key_len > cache->pending_capacity) {
+		size_t capacity = cache->pending_capacity ? cache->pending_capacity : 4096;
+		while (capacity < cache->pending_size + NID_CACHE_RECORD_SIZE + key_len)
+			capacity *= 2;
+		record = realloc(cache->pending, capacity);
+		if (!record)
+			return -1;
+		cache->pending = record;
+		cache->pending_capacity = capacity;
+	}
+
+	key = malloc(key_len ? key_len : 1);
+	if (!key)
+		return -1;
+	if (prefix_len)
+		memcpy(key, prefix, prefix_len);
+	if (len)
+		memcpy(key + prefix_len, msg, len);
+
+	if (insert_entry(cache, key, key_len, nid, 1) <= 0) {
+		free(key);
+		return -1;
+	}
+
+	record = cache->pending + cache->pending_size;
+	record[0] = nid;
+	record[1] = nid >> 8;
+	record[2] = nid >> 16;
+	record[3] = nid >> 24;
+	record[4] = key_len;
+	record[5] = key_len >> 8;
+	memcpy(record + NID_CACHE_RECORD_SIZE, key, key_len);
+	cache->pending_size += NID_CACHE_RECORD_SIZE + key_len;
+	return 0;
+}
+
+static int create_file(const char *path)
+{
+	uint8_t header[NID_CACHE_HEADER_SIZE] = NID_CACHE_MAGIC;
+	int fd;
+
+	// O_EXCL so that only one of several tools starting together writes the header
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_BINARY, 0644);
+	if (fd < 0)
+		return errno == EEXIST ? 0 : -1;
+
+	header[8] = NID_CACHE_VERSION;
+	if (write(fd, header, sizeof(header)) != sizeof(header)) {
+		close(fd);
+		return -1;
+	}
+
+	return close(fd);
+}
+
+static int load_file(nid_cache *cache)
+{
+	struct stat st;
+	const uint8_t *record, *end;
+	uint32_t nid, len;
+	int fd;
+
+	fd = open(cache->path, O_RDONLY | O_BINARY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		goto error;
+
+	if (st.st_size < NID_CACHE_HEADER_SIZE) {
+		fprintf(stderr, "warning: NID cache '%s' is truncated, ignoring it\n", cache->path);
+		close(fd);
+		return -1;
+	}
+
+	cache->map_size = st.st_size;
+#ifdef HAVE_FILE_MMAP
+	cache->map = mmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (cache->map == MAP_FAILED) {
+		cache->map = NULL;
+		goto error;
+	}
+#else
+	cache->map = malloc(cache->map_size);
+	if (!cache->map || read(fd, cache->map, cache->map_size) != (ssize_t)cache->map_size)
+		goto error;
+#endif
+	close(fd);
+	fd = -1;
+
+	if (memcmp(cache->map, NID_CACHE_MAGIC, 8) != 0 || cache->map[8] != NID_CACHE_VERSION) {
+		fprintf(stderr, "warning: '%s' is not a NID cache of this version, ignoring it\n", cache->path);
+		return -1;
+	}
+
+	end = cache->map + cache->map_size;
+	for (record = cache->map + NID_CACHE_HEADER_SIZE; end - record >= NID_CACHE_RECORD_SIZE; record += NID_CACHE_RECORD_SIZE + len) {
+		nid = record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24);
+		len = record[4] | (record[5] << 8);
+		if (end - record - NID_CACHE_RECORD_SIZE < len)
+			break;
+		if (insert_entry(cache, record + NID_CACHE_RECORD_SIZE, len, nid, 0) < 0)
+			return -1;
+	}
+
+	return 0;
+
+error:
+	fprintf(stderr, "warning: could not read NID cache '%s': %s\n", cache->path, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	return -1;
+}
+
+static int write_pending(nid_cache *cache)
+{
+	const uint8_t *data = cache->pending;
+	size_t left = cache->pending_size;
+	ssize_t written;
+	int fd;
+
+	if (left == 0)
+		return 0;
+
+	// One write per tool run keeps the records of concurrent tools apart
+	fd = open(cache->path, O_WRONLY | O_APPEND | O_BINARY);
+	if (fd < 0)
+		return -1;
+
+	while (left > 0) {
+		written = write(fd, data, left);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		data += written;
+		left -= written;
+	}
+
+	return close(fd);
+}
+
+static void free_cache(nid_cache *cache)
+{
+	size_t i;
+
+	for (i = 0; i < cache->capacity; i++) {
+		if (cache->table[i].owned)
+			free((void *)cache->table[i].key);
+	}
+	free(cache->table);
+	free(cache->pending);
+
+	if (cache->map) {
+#ifdef HAVE_FILE_MMAP
+		munmap(cache->map, cache->map_size);
+#else
+		free(cache->map);
+#endif
+	}
+
+	free(cache->path);
+	free(cache);
+}
+
+int nid_cache_open(const char *path, nid_cache_mode mode)
+{
+	nid_cache *cache;
+
+	if (g_cache)
+		nid_cache_close();
+
+	cache = calloc(1, sizeof(nid_cache));
+	if (!cache)
+		return -1;
+
+	cache->path = strdup(path);
+	cache->mode = mode;
+	if (!cache->path || grow_table(cache) < 0) {
+		free_cache(cache);
+		return -1;
+	}
+
+	if (create_file(path) < 0) {
+		fprintf(stderr, "warning: could not create NID cache '%s': %s\n", path, strerror(errno));
+		free_cache(cache);
+		return -1;
+	}
+
+	if (load_file(cache) < 0) {
+		free_cache(cache);
+		return -1;
+	}
+
+	g_cache = cache;
+	return 0;
+}
+
+int nid_cache_open_default(void)
+{
+	const char *path = getenv(NID_CACHE_ENV);
+	const char *verify = getenv(NID_CACHE_VERIFY_ENV);
+
+	if (!path || path[0] == '\0')
+		return 0;
+
+	return nid_cache_open(path, verify && strcmp(verify, "0") != 0 ? NID_CACHE_VERIFY : NID_CACHE_USE);
+}
+
+int nid_cache_close(void)
+{
+	nid_cache *cache = g_cache;
+	int ret;
+
+	if (!cache)
+		return 0;
+	g_cache = NULL;
+
+	ret = cache->mismatches;
+	if (write_pending(cache) < 0) {
+		fprintf(stderr, "warning: could not update NID cache '%s': %s\n", cache->path, strerror(errno));
+		ret = -1;
+	}
+	else if (cache->mismatches) {
+		fprintf(stderr, "error: %d stale entries in NID cache '%s', delete it to rebuild\n", cache->mismatches, cache->path);
+	}
+
+	free_cache(cache);
+	return ret;
+}
+
+void nid_cache_32_batch_prefixed(const uint8_t *prefix, size_t prefix_len,
+		const uint8_t *const msgs[], const size_t lens[], size_t n, uint32_t nids[])
+{
+	nid_cache *cache = g_cache;
+	const uint8_t **miss_msgs = NULL;
+	size_t *miss_lens = NULL, *miss_index, misses = 0, i, j;
+	uint32_t *miss_nids;
+	nid_cache_entry *entry;
+
+	if (prefix == NULL)
+		prefix_len = 0;
+
+	if (!cache) {
+		sha256_32_batch_prefixed(prefix, prefix_len, msgs, lens, n, nids);
+		return;
+	}
+
+	miss_msgs = malloc(n * sizeof(*miss_msgs));
+	miss_lens = malloc(n * sizeof(*miss_lens));
+	miss_index = malloc(n * sizeof(*miss_index));
+	miss_nids = malloc(n * sizeof(*miss_nids));
+	if (!miss_msgs || !miss_lens || !miss_index || !miss_nids) {
+		sha256_32_batch_prefixed(prefix, prefix_len, msgs, lens, n, nids);
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		entry = find_slot(cache, prefix, prefix_len, msgs[i], lens[i]);
+		if (entry->key != NULL && cache->mode != NID_CACHE_VERIFY) {
+			nids[i] = entry->nid;
+			continue;
+		}
+		miss_msgs[misses] = msgs[i];
+		miss_lens[misses] = lens[i];
+		miss_index[misses] = i;
+		misses++;
+	}
+
+	if (misses > 0)
+		sha256_32_batch_prefixed(prefix, prefix_len, miss_msgs, miss_lens, misses, miss_nids);
+
+	for (j = 0; j < misses; j++) {
+		i = miss_index[j];
+		nids[i] = miss_nids[j];
+
+		entry = find_slot(cache, prefix, prefix_len, msgs[i], lens[i]);
+		if (entry->key != NULL) {
+			if (entry->nid != nids[i]) {
+				fprintf(stderr, "error: NID cache has 0x%08X for '%.*s', expected 0x%08X\n",
+						entry->nid, (int)lens[i], msgs[i], nids[i]);
+				cache->mismatches++;
+			}
+			continue;
+		}
+
+		// a full cache only costs hashing again next time
+		append_record(cache, prefix, prefix_len, msgs[i], lens[i], nids[i]);
+	}
+
+out:
+	free(miss_msgs);
+	free(miss_lens);
+	free(miss_index);
+	free(miss_nids);
+}
@@ -0,0 +1,35 @@
+#ifndef NID_CACHE_H
+#define NID_CACHE_H
+
+#include <vita-toolchain-public.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Optional on-disk cache of symbol NIDs, keyed by the exact bytes that are
+ * hashed (the name, or htonl(version) || library name || name). The file is
+ * append-only and mapped read-only at open, so concurrent tools sharing it
+ * at worst hash a name again. There is a single process-wide cache and it
+ * is not thread-safe. */
+
+#define NID_CACHE_ENV "VITA_NID_CACHE"
+/* Set to anything but "0" to rehash every cached entry and report mismatches */
+#define NID_CACHE_VERIFY_ENV "VITA_NID_CACHE_VERIFY"
+
+typedef enum {
+	NID_CACHE_USE,
+	NID_CACHE_VERIFY
+} nid_cache_mode;
+
+/* Returns 0 on success, including when the file could only be read */
+VITA_TOOLCHAIN_PUBLIC int nid_cache_open(const char *path, nid_cache_mode mode);
+/* Opens the cache named by $VITA_NID_CACHE if set and not empty */
+VITA_TOOLCHAIN_PUBLIC int nid_cache_open_default(void);
+/* Appends the new entries, returns the number of mismatches found in
+ * verify mode or -1 if the cache could not be written */
+VITA_TOOLCHAIN_PUBLIC int nid_cache_close(void);
+
+/* sha256_32_batch_prefixed() going through the cache when one is open */
+VITA_TOOLCHAIN_PUBLIC void nid_cache_32_batch_prefixed(const uint8_t *prefix, size_t prefix_len,
+		const uint8_t *const msgs[], const size_t lens[], size_t n, uint32_t nids[]);
+
+#endif
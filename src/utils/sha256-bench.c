@@ -0,0 +1,109 @@
+/* Compare the SHA-256 block implementations on bulk data (module NIDs and
+ * fself digests) and on short symbol names (export NIDs), one by one and
+ * through the batch API. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sha256.h"
+
+#define BULK_SIZE (64 * 1024 * 1024)
+#define NAME_COUNT (1024 * 1024)
+
+static const char *impl_names[] = { "generic", "shani", "armv8" };
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	uint8_t *bulk;
+	char (*names)[32];
+	const uint8_t **name_ptrs;
+	size_t *name_lens;
+	uint32_t *nids, *batch_nids;
+	uint8_t hash[SHA256_MAC_LEN], reference[SHA256_MAC_LEN];
+	uint32_t nid_sum, reference_sum = 0;
+	int have_reference = 0;
+	double start, bulk_time, names_time, batch_time;
+	size_t i, len;
+	int impl;
+
+	bulk = malloc(BULK_SIZE);
+	names = malloc(NAME_COUNT * sizeof(*names));
+	name_ptrs = malloc(NAME_COUNT * sizeof(*name_ptrs));
+	name_lens = malloc(NAME_COUNT * sizeof(*name_lens));
+	nids = malloc(NAME_COUNT * sizeof(*nids));
+	batch_nids = malloc(NAME_COUNT * sizeof(*batch_nids));
+	if (!bulk || !names || !name_ptrs || !name_lens || !nids || !batch_nids) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	srand(1);
+	for (i = 0; i < BULK_SIZE; i++)
+		bulk[i] = rand();
+	for (i = 0; i < NAME_COUNT; i++) {
+		snprintf(names[i], sizeof(names[i]), "sceKernelSymbol%zu", i);
+		name_ptrs[i] = (const uint8_t *)names[i];
+		name_lens[i] = strlen(names[i]);
+	}
+
+	printf("default implementation: %s\n", sha256_impl_name());
+
+	for (impl = 0; impl < sizeof(impl_names) / sizeof(impl_names[0]); impl++) {
+		if (!sha256_set_impl(impl_names[impl])) {
+			printf("%-8s unsupported\n", impl_names[impl]);
+			continue;
+		}
+
+		start = now();
+		sha256_vector(1, (uint8_t *[]){bulk}, (size_t[]){BULK_SIZE}, hash);
+		bulk_time = now() - start;
+
+		nid_sum = 0;
+		start = now();
+		for (i = 0; i < NAME_COUNT; i++) {
+			uint8_t *name = (uint8_t *)names[i];
+			len = strlen(names[i]);
+			nids[i] = sha256_32_vector(1, &name, &len);
+			nid_sum += nids[i];
+		}
+		names_time = now() - start;
+
+		start = now();
+		sha256_32_batch(name_ptrs, name_lens, NAME_COUNT, batch_nids);
+		batch_time = now() - start;
+
+		printf("%-8s %8.1f MiB/s %10.0f NIDs/s %10.0f batched NIDs/s\n", impl_names[impl],
+				BULK_SIZE / (1024.0 * 1024.0) / bulk_time, NAME_COUNT / names_time, NAME_COUNT / batch_time);
+
+		if (memcmp(nids, batch_nids, NAME_COUNT * sizeof(*nids)) != 0) {
+			fprintf(stderr, "%s batched NIDs do not match\n", impl_names[impl]);
+			return 1;
+		}
+
+		if (!have_reference) {
+			memcpy(reference, hash, sizeof(hash));
+			reference_sum = nid_sum;
+			have_reference = 1;
+		} else if (memcmp(reference, hash, sizeof(hash)) != 0 || reference_sum != nid_sum) {
+			fprintf(stderr, "%s does not match the generic implementation\n", impl_names[impl]);
+			return 1;
+		}
+	}
+
+	free(batch_nids);
+	free(nids);
+	free(name_lens);
+	free(name_ptrs);
+	free(names);
+	free(bulk);
+	return 0;
+}
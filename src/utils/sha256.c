@@ -3,6 +3,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256_HAVE_SHANI
+#endif
+
+#if defined(__aarch64__) && defined(__GNUC__) && (defined(__linux__) || defined(__APPLE__))
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#ifdef __clang__
+#define SHA256_ARMV8_TARGET __attribute__((target("crypto")))
+#else
+#define SHA256_ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+#define SHA256_HAVE_ARMV8
+#endif
+
 #define READ_BUFFER	(1*1024*1024)
 
 uint32_t k[64] = {
@@ -18,46 +38,224 @@ uint32_t k[64] = {
 
 
 
-void sha256_transform(SHA256_CTX *ctx, uint8_t data[])
-{  
+static void sha256_blocks_generic(uint32_t state[8], const uint8_t *data, size_t nblocks)
+{
    uint32_t a,b,c,d,e,f,g,h,i,j,t1,t2,m[64];
-      
-   for (i=0,j=0; i < 16; ++i, j += 4)
-      m[i] = (data[j] << 24) | (data[j+1] << 16) | (data[j+2] << 8) | (data[j+3]);
-   for ( ; i < 64; ++i)
-      m[i] = SIG1(m[i-2]) + m[i-7] + SIG0(m[i-15]) + m[i-16];
-
-   a = ctx->state[0];
-   b = ctx->state[1];
-   c = ctx->state[2];
-   d = ctx->state[3];
-   e = ctx->state[4];
-   f = ctx->state[5];
-   g = ctx->state[6];
-   h = ctx->state[7];
-   
-   for (i = 0; i < 64; ++i) {
-      t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
-      t2 = EP0(a) + MAJ(a,b,c);
-      h = g;
-      g = f;
-      f = e;
-      e = d + t1;
-      d = c;
-      c = b;
-      b = a;
-      a = t1 + t2;
+
+   for (; nblocks > 0; --nblocks, data += 64) {
+      for (i=0,j=0; i < 16; ++i, j += 4)
+         m[i] = (data[j] << 24) | (data[j+1] << 16) | (data[j+2] << 8) | (data[j+3]);
+      for ( ; i < 64; ++i)
+         m[i] = SIG1(m[i-2]) + m[i-7] + SIG0(m[i-15]) + m[i-16];
+
+      a = state[0];
+      b = state[1];
+      c = state[2];
+      d = state[3];
+      e = state[4];
+      f = state[5];
+      g = state[6];
+      h = state[7];
+
+      for (i = 0; i < 64; ++i) {
+         t1 = h + EP1(e) + CH(e,f,g) + k[i] + m[i];
+         t2 = EP0(a) + MAJ(a,b,c);
+         h = g;
+         g = f;
+         f = e;
+         e = d + t1;
+         d = c;
+         c = b;
+         b = a;
+         a = t1 + t2;
+      }
+
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+      state[4] += e;
+      state[5] += f;
+      state[6] += g;
+      state[7] += h;
    }
-   
-   ctx->state[0] += a;
-   ctx->state[1] += b;
-   ctx->state[2] += c;
-   ctx->state[3] += d;
-   ctx->state[4] += e;
-   ctx->state[5] += f;
-   ctx->state[6] += g;
-   ctx->state[7] += h;
-}  
+}
+
+#ifdef SHA256_HAVE_SHANI
+/* Intel SHA extensions, the state is kept as ABEF/CDGH as the instructions expect */
+__attribute__((target("sha,ssse3,sse4.1")))
+static void sha256_blocks_shani(uint32_t state[8], const uint8_t *data, size_t nblocks)
+{
+   const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+   __m128i state0, state1, abef_save, cdgh_save, msg, tmp, w[4];
+   int g;
+
+   tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+   state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+   tmp = _mm_shuffle_epi32(tmp, 0xB1);          /* CDAB */
+   state1 = _mm_shuffle_epi32(state1, 0x1B);    /* EFGH */
+   state0 = _mm_alignr_epi8(tmp, state1, 8);    /* ABEF */
+   state1 = _mm_blend_epi16(state1, tmp, 0xF0); /* CDGH */
+
+   for (; nblocks > 0; --nblocks, data += 64) {
+      abef_save = state0;
+      cdgh_save = state1;
+
+      for (g = 0; g < 16; ++g) {
+         if (g < 4) {
+            w[g] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + g * 16)), mask);
+         } else {
+            tmp = _mm_sha256msg1_epu32(w[g & 3], w[(g - 3) & 3]);
+            tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(g - 1) & 3], w[(g - 2) & 3], 4));
+            w[g & 3] = _mm_sha256msg2_epu32(tmp, w[(g - 1) & 3]);
+         }
+
+         msg = _mm_add_epi32(w[g & 3], _mm_loadu_si128((const __m128i *)&k[g * 4]));
+         state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+         msg = _mm_shuffle_epi32(msg, 0x0E);
+         state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+      }
+
+      state0 = _mm_add_epi32(state0, abef_save);
+      state1 = _mm_add_epi32(state1, cdgh_save);
+   }
+
+   tmp = _mm_shuffle_epi32(state0, 0x1B);       /* FEBA */
+   state1 = _mm_shuffle_epi32(state1, 0xB1);    /* DCHG */
+   state0 = _mm_blend_epi16(tmp, state1, 0xF0); /* DCBA */
+   state1 = _mm_alignr_epi8(state1, tmp, 8);    /* ABEF */
+
+   _mm_storeu_si128((__m128i *)&state[0], state0);
+   _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static int sha256_shani_supported(void)
+{
+   unsigned int eax, ebx, ecx, edx;
+
+   if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return 0;
+   if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1))
+      return 0;
+   if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+      return 0;
+   return (ebx & (1 << 29)) != 0;
+}
+#endif
+
+#ifdef SHA256_HAVE_ARMV8
+/* ARMv8 cryptography extensions */
+SHA256_ARMV8_TARGET
+static void sha256_blocks_armv8(uint32_t state[8], const uint8_t *data, size_t nblocks)
+{
+   uint32x4_t state0, state1, abcd_save, efgh_save, msg, tmp, w[4];
+   int g;
+
+   state0 = vld1q_u32(&state[0]);
+   state1 = vld1q_u32(&state[4]);
+
+   for (; nblocks > 0; --nblocks, data += 64) {
+      abcd_save = state0;
+      efgh_save = state1;
+
+      for (g = 0; g < 16; ++g) {
+         if (g < 4)
+            w[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + g * 16)));
+         else
+            w[g & 3] = vsha256su1q_u32(vsha256su0q_u32(w[g & 3], w[(g - 3) & 3]), w[(g - 2) & 3], w[(g - 1) & 3]);
+
+         msg = vaddq_u32(w[g & 3], vld1q_u32(&k[g * 4]));
+         tmp = state0;
+         state0 = vsha256hq_u32(state0, state1, msg);
+         state1 = vsha256h2q_u32(state1, tmp, msg);
+      }
+
+      state0 = vaddq_u32(state0, abcd_save);
+      state1 = vaddq_u32(state1, efgh_save);
+   }
+
+   vst1q_u32(&state[0], state0);
+   vst1q_u32(&state[4], state1);
+}
+
+static int sha256_armv8_supported(void)
+{
+#if defined(__APPLE__)
+   return 1;
+#else
+   return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+#endif
+}
+#endif
+
+typedef struct {
+   const char *name;
+   void (*blocks)(uint32_t state[8], const uint8_t *data, size_t nblocks);
+   int (*supported)(void);
+} sha256_impl;
+
+/* Fastest first */
+static const sha256_impl sha256_impls[] = {
+#ifdef SHA256_HAVE_SHANI
+   { "shani", sha256_blocks_shani, sha256_shani_supported },
+#endif
+#ifdef SHA256_HAVE_ARMV8
+   { "armv8", sha256_blocks_armv8, sha256_armv8_supported },
+#endif
+   { "generic", sha256_blocks_generic, NULL },
+};
+
+static const sha256_impl *sha256_active_impl;
+#ifdef SHA256_HAVE_SHANI
+/* Whether sha256_32_batch() uses the AVX2 lanes, -1 until decided */
+static int sha256_batch_avx2 = -1;
+#endif
+
+static const sha256_impl *sha256_get_impl(void)
+{
+   size_t i;
+
+   /* Every thread picks the same one, so a race here is harmless */
+   if (sha256_active_impl == NULL) {
+      for (i = 0; i < sizeof(sha256_impls) / sizeof(sha256_impls[0]); ++i) {
+         if (sha256_impls[i].supported == NULL || sha256_impls[i].supported()) {
+            sha256_active_impl = &sha256_impls[i];
+            break;
+         }
+      }
+   }
+
+   return sha256_active_impl;
+}
+
+const char *sha256_impl_name(void)
+{
+   return sha256_get_impl()->name;
+}
+
+int sha256_set_impl(const char *name)
+{
+   size_t i;
+
+   for (i = 0; i < sizeof(sha256_impls) / sizeof(sha256_impls[0]); ++i) {
+      if (strcmp(sha256_impls[i].name, name) != 0)
+         continue;
+      if (sha256_impls[i].supported != NULL && !sha256_impls[i].supported())
+         return 0;
+      sha256_active_impl = &sha256_impls[i];
+#ifdef SHA256_HAVE_SHANI
+      sha256_batch_avx2 = -1;
+#endif
+      return 1;
+   }
+
+   return 0;
+}
+
+void sha256_transform(SHA256_CTX *ctx, uint8_t data[])
+{
+   sha256_get_impl()->blocks(ctx->state, data, 1);
+}
 
 void sha256_init(SHA256_CTX *ctx)
 {  
@@ -76,17 +274,36 @@ void sha256_init(SHA256_CTX *ctx)
 
 void sha256_update(SHA256_CTX *ctx, uint8_t data[], uint32_t len)
 {  
-   uint32_t i;
+   const sha256_impl *impl = sha256_get_impl();
+   uint32_t i = 0, n, nblocks;
    
-   for (i=0; i < len; ++i) { 
-      ctx->data[ctx->datalen] = data[i]; 
-      ctx->datalen++; 
-      if (ctx->datalen == 64) { 
-         sha256_transform(ctx,ctx->data);
+   // Top up a partially filled block first
+   if (ctx->datalen > 0) {
+      n = 64 - ctx->datalen;
+      if (n > len)
+         n = len;
+      memcpy(ctx->data + ctx->datalen, data, n);
+      ctx->datalen += n;
+      i = n;
+      if (ctx->datalen < 64)
+         return;
+      impl->blocks(ctx->state, ctx->data, 1);
+      DBL_INT_ADD(ctx->bitlen[0],ctx->bitlen[1],512); 
+      ctx->datalen = 0;
+   }
+   
+   // Whole blocks are hashed straight from the input
+   nblocks = (len - i) / 64;
+   if (nblocks > 0) {
+      impl->blocks(ctx->state, data + i, nblocks);
+      for (n = 0; n < nblocks; ++n) {
          DBL_INT_ADD(ctx->bitlen[0],ctx->bitlen[1],512); 
-         ctx->datalen = 0; 
-      }  
-   }  
+      }
+      i += nblocks * 64;
+   }
+   
+   memcpy(ctx->data, data + i, len - i);
+   ctx->datalen = len - i;
 }  
 
 void sha256_final(SHA256_CTX *ctx, uint8_t hash[])
@@ -254,42 +471,314 @@ uint32_t sha256_32_vector(size_t num_elem, uint8_t *addr[],  size_t *len)
 	return (hash[0] << 24) | (hash[1] << 16) | (hash[2] << 8) | hash[3];
 }
 
-int sha256_file(const char *file, uint8_t *mac)
+/* Messages padded into at most this many blocks go through the batch kernels,
+ * longer ones (never a symbol name in practice) are hashed one by one */
+#define BATCH_MAX_BLOCKS 4
+#define BATCH_LANES 8
+
+typedef uint8_t sha256_batch_buf[BATCH_MAX_BLOCKS * 64];
+
+static const uint32_t sha256_iv[8] = {
+   0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+   0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/* Lays out prefix || msg with its final padding, returns the number of
+ * blocks or 0 if it does not fit */
+static size_t sha256_batch_pad(uint8_t *buf, const uint8_t *prefix, size_t prefix_len,
+         const uint8_t *msg, size_t len)
+{
+   size_t total = prefix_len + len, nblocks = (total + 8) / 64 + 1, i;
+   uint64_t bits = (uint64_t)total * 8;
+
+   if (nblocks > BATCH_MAX_BLOCKS)
+      return 0;
+
+   memcpy(buf, prefix, prefix_len);
+   memcpy(buf + prefix_len, msg, len);
+   buf[total] = 0x80;
+   memset(buf + total + 1, 0, nblocks * 64 - total - 1);
+   for (i = 0; i < 8; ++i)
+      buf[nblocks * 64 - 1 - i] = bits >> (i * 8);
+
+   return nblocks;
+}
+
+static uint32_t sha256_32_prefixed(const uint8_t *prefix, size_t prefix_len,
+         const uint8_t *msg, size_t len)
+{
+   uint8_t *addr[2] = { (uint8_t *)prefix, (uint8_t *)msg };
+   size_t lens[2] = { prefix_len, len };
+
+   return sha256_32_vector(2, addr, lens);
+}
+
+#ifdef SHA256_HAVE_SHANI
+#define AVX2_ROTR(x,n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+/* Eight independent messages, one per 32-bit lane. Lanes with fewer blocks
+ * stop updating their state once done. */
+__attribute__((target("avx2")))
+static void sha256_x8_avx2(sha256_batch_buf *bufs, const size_t nblocks[BATCH_LANES],
+         uint32_t nids[BATCH_LANES])
+{
+   __m256i s[8], v[8], w[16], t1, t2, active, lane_blocks;
+   uint32_t words[16][BATCH_LANES];
+   size_t max_blocks = 0, b;
+   int i, j;
+
+   for (j = 0; j < BATCH_LANES; ++j) {
+      if (nblocks[j] > max_blocks)
+         max_blocks = nblocks[j];
+   }
+   lane_blocks = _mm256_setr_epi32(nblocks[0], nblocks[1], nblocks[2], nblocks[3],
+         nblocks[4], nblocks[5], nblocks[6], nblocks[7]);
+   for (i = 0; i < 8; ++i)
+      s[i] = _mm256_set1_epi32(sha256_iv[i]);
+
+   for (b = 0; b < max_blocks; ++b) {
+      for (j = 0; j < BATCH_LANES; ++j) {
+         const uint8_t *data = bufs[j] + b * 64;
+         for (i = 0; i < 16; ++i)
+            words[i][j] = (data[i*4] << 24) | (data[i*4+1] << 16) | (data[i*4+2] << 8) | data[i*4+3];
+      }
+      for (i = 0; i < 16; ++i)
+         w[i] = _mm256_loadu_si256((const __m256i *)words[i]);
+      for (i = 0; i < 8; ++i)
+         v[i] = s[i];
+
+      for (i = 0; i < 64; ++i) {
+         if (i >= 16) {
+            __m256i w2 = w[(i - 2) & 15], w15 = w[(i - 15) & 15];
+            __m256i sig1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(w2, 17), AVX2_ROTR(w2, 19)), _mm256_srli_epi32(w2, 10));
+            __m256i sig0 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(w15, 7), AVX2_ROTR(w15, 18)), _mm256_srli_epi32(w15, 3));
+            w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], sig0), _mm256_add_epi32(w[(i - 7) & 15], sig1));
+         }
+
+         t1 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(v[4], 6), AVX2_ROTR(v[4], 11)), AVX2_ROTR(v[4], 25));
+         t1 = _mm256_add_epi32(t1, _mm256_xor_si256(_mm256_and_si256(v[4], v[5]), _mm256_andnot_si256(v[4], v[6])));
+         t1 = _mm256_add_epi32(_mm256_add_epi32(t1, v[7]), _mm256_add_epi32(w[i & 15], _mm256_set1_epi32(k[i])));
+         t2 = _mm256_xor_si256(_mm256_xor_si256(AVX2_ROTR(v[0], 2), AVX2_ROTR(v[0], 13)), AVX2_ROTR(v[0], 22));
+         t2 = _mm256_add_epi32(t2, _mm256_or_si256(_mm256_and_si256(v[0], v[1]), _mm256_and_si256(v[2], _mm256_or_si256(v[0], v[1]))));
+
+         v[7] = v[6];
+         v[6] = v[5];
+         v[5] = v[4];
+         v[4] = _mm256_add_epi32(v[3], t1);
+         v[3] = v[2];
+         v[2] = v[1];
+         v[1] = v[0];
+         v[0] = _mm256_add_epi32(t1, t2);
+      }
+
+      active = _mm256_cmpgt_epi32(lane_blocks, _mm256_set1_epi32(b));
+      for (i = 0; i < 8; ++i)
+         s[i] = _mm256_blendv_epi8(s[i], _mm256_add_epi32(s[i], v[i]), active);
+   }
+
+   // The NID is the first word of the hash
+   _mm256_storeu_si256((__m256i *)nids, s[0]);
+}
+
+static int sha256_avx2_supported(void)
+{
+   unsigned int eax, ebx, ecx, edx, xcr0, xcr0_hi;
+
+   if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+      return 0;
+   // The OS has to save the YMM registers
+   if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+      return 0;
+   __asm__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0_hi) : "c" (0));
+   if ((xcr0 & 6) != 6)
+      return 0;
+   if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+      return 0;
+   return (ebx & bit_AVX2) != 0;
+}
+#endif
+
+#ifdef SHA256_HAVE_SHANI
+/* With hardware SHA instructions one message at a time already beats eight
+ * software lanes, so the wide kernel only stands in for the generic one */
+static int sha256_use_batch_avx2(void)
+{
+   if (sha256_batch_avx2 < 0)
+      sha256_batch_avx2 = sha256_get_impl()->blocks == sha256_blocks_generic && sha256_avx2_supported();
+
+   return sha256_batch_avx2;
+}
+
+static void sha256_32_batch_avx2(const uint8_t *prefix, size_t prefix_len,
+         const uint8_t *const msgs[], const size_t lens[], size_t n, uint32_t nids[])
+{
+   sha256_batch_buf bufs[BATCH_LANES];
+   size_t nblocks[BATCH_LANES], lane_msg[BATCH_LANES];
+   uint32_t lane_nids[BATCH_LANES];
+   size_t i, lanes = 0;
+
+   for (i = 0; i < n; ++i) {
+      nblocks[lanes] = sha256_batch_pad(bufs[lanes], prefix, prefix_len, msgs[i], lens[i]);
+      if (nblocks[lanes] == 0) {
+         nids[i] = sha256_32_prefixed(prefix, prefix_len, msgs[i], lens[i]);
+         continue;
+      }
+
+      lane_msg[lanes] = i;
+      if (++lanes < BATCH_LANES && i + 1 < n)
+         continue;
+
+      // Unused lanes of the last group have no blocks to hash
+      while (lanes < BATCH_LANES)
+         nblocks[lanes++] = 0;
+      sha256_x8_avx2(bufs, nblocks, lane_nids);
+      for (lanes = 0; lanes < BATCH_LANES && nblocks[lanes] != 0; ++lanes)
+         nids[lane_msg[lanes]] = lane_nids[lanes];
+      lanes = 0;
+   }
+
+   // The last message was too long for a lane, the group is still pending
+   if (lanes > 0) {
+      while (lanes < BATCH_LANES)
+         nblocks[lanes++] = 0;
+      sha256_x8_avx2(bufs, nblocks, lane_nids);
+      for (lanes = 0; lanes < BATCH_LANES && nblocks[lanes] != 0; ++lanes)
+         nids[lane_msg[lanes]] = lane_nids[lanes];
+   }
+}
+#endif
+
+void sha256_32_batch_prefixed(const uint8_t *prefix, size_t prefix_len,
+         const uint8_t *const msgs[], const size_t lens[], size_t n, uint32_t nids[])
+{
+   sha256_batch_buf buf;
+   uint32_t state[8];
+   size_t i, nblocks;
+
+   if (prefix == NULL)
+      prefix_len = 0;
+
+#ifdef SHA256_HAVE_SHANI
+   if (sha256_use_batch_avx2()) {
+      sha256_32_batch_avx2(prefix, prefix_len, msgs, lens, n, nids);
+      return;
+   }
+#endif
+
+   // Padding in place skips the context bookkeeping of sha256_update/final
+   for (i = 0; i < n; ++i) {
+      nblocks = sha256_batch_pad(buf, prefix, prefix_len, msgs[i], lens[i]);
+      if (nblocks == 0) {
+         nids[i] = sha256_32_prefixed(prefix, prefix_len, msgs[i], lens[i]);
+         continue;
+      }
+      memcpy(state, sha256_iv, sizeof(state));
+      sha256_get_impl()->blocks(state, buf, nblocks);
+      nids[i] = state[0];
+   }
+}
+
+void sha256_32_batch(const uint8_t *const msgs[], const size_t lens[], size_t n, uint32_t nids[])
+{
+   sha256_32_batch_prefixed(NULL, 0, msgs, lens, n, nids);
+}
+
+void sha256_digest_init(sha256_digest *digest)
+{
+	sha256_init(&digest->ctx);
+}
+
+void sha256_digest_update(sha256_digest *digest, const void *data, size_t len)
+{
+	const uint8_t *ptr = data;
+	uint32_t chunk;
+
+	while (len > 0) {
+		chunk = len > READ_BUFFER ? READ_BUFFER : len;
+		sha256_update(&digest->ctx, (uint8_t *)ptr, chunk);
+		ptr += chunk;
+		len -= chunk;
+	}
+}
+
+int sha256_digest_update_file(sha256_digest *digest, FILE *fp)
 {
 	size_t read = 0;
-	SHA256_CTX ctx;
+	uint8_t *data = malloc(READ_BUFFER);
+
+	if (!data)
+		return -1;
+
+	while ((read = fread(data, 1, READ_BUFFER, fp)) > 0) {
+		sha256_update(&digest->ctx, data, read);
+	}
+
+	free(data);
+	return ferror(fp) ? -1 : 0;
+}
+
+void sha256_digest_fork(const sha256_digest *digest, sha256_digest *copy)
+{
+	*copy = *digest;
+}
+
+void sha256_digest_hash(const sha256_digest *digest, uint8_t *mac)
+{
+	SHA256_CTX ctx = digest->ctx;
+
+	sha256_final(&ctx, mac);
+}
+
+uint32_t sha256_digest_module_nid(const sha256_digest *digest)
+{
+	uint8_t hash[32];
+	uint8_t *hash_ptr = hash;
+	size_t len = sizeof(hash);
+
+	sha256_digest_hash(digest, hash);
+	return sha256_32_vector(1, &hash_ptr, &len);
+}
+
+int sha256_file(const char *file, uint8_t *mac)
+{
+	sha256_digest digest;
 	FILE *fp = fopen(file, "rb");
 	
 	if (!fp)
 		return -1;
 	
-	uint8_t *data = malloc(READ_BUFFER);
-	
-	sha256_init(&ctx);
-	
-	while ((read = fread(data, 1, READ_BUFFER, fp)) > 0) {
-		sha256_update(&ctx, data, read);
+	sha256_digest_init(&digest);
+	if (sha256_digest_update_file(&digest, fp) < 0) {
+		fclose(fp);
+		return -1;
 	}
 	
-    sha256_final(&ctx, mac);
-	free(data);
+	sha256_digest_hash(&digest, mac);
 	fclose(fp);
 	return 0;
 }
 
 int sha256_32_file(const char *file, uint32_t *nid)
 {
-  uint8_t hash[32];
-  uint8_t *hash_ptr = hash;
+  sha256_digest digest;
+  FILE *fp = fopen(file, "rb");
   
-  if (sha256_file(file, hash) < 0)
+  if (!fp)
   {
     fprintf(stderr, "error: could not calculate SHA256 of '%s'\n", file);
     // TODO: handle better, cleanup tree
     return -1;
   }
   
-  size_t len = 32;
-  *nid = sha256_32_vector(1, &hash_ptr, &len);
+  sha256_digest_init(&digest);
+  if (sha256_digest_update_file(&digest, fp) < 0)
+  {
+    fprintf(stderr, "error: could not calculate SHA256 of '%s'\n", file);
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+  
+  *nid = sha256_digest_module_nid(&digest);
   return 0;
 }
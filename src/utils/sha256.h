@@ -3,6 +3,7 @@
 
 #include <vita-toolchain-public.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #define SHA256_MAC_LEN 32
@@ -29,9 +30,15 @@ typedef struct {
 
 
 void sha256_transform(SHA256_CTX *ctx, uint8_t data[]);
-void sha256_init(SHA256_CTX *ctx);
-void sha256_update(SHA256_CTX *ctx, uint8_t data[], uint32_t len);
-void sha256_final(SHA256_CTX *ctx, uint8_t hash[]);
+VITA_TOOLCHAIN_PUBLIC void sha256_init(SHA256_CTX *ctx);
+VITA_TOOLCHAIN_PUBLIC void sha256_update(SHA256_CTX *ctx, uint8_t data[], uint32_t len);
+VITA_TOOLCHAIN_PUBLIC void sha256_final(SHA256_CTX *ctx, uint8_t hash[]);
+
+/* The block function is picked at first use, the fastest the CPU supports
+ * among "shani", "armv8" and the portable "generic" */
+VITA_TOOLCHAIN_PUBLIC const char *sha256_impl_name(void);
+/* Returns 0 if the implementation is unknown or not supported by the CPU */
+VITA_TOOLCHAIN_PUBLIC int sha256_set_impl(const char *name);
 
 VITA_TOOLCHAIN_PUBLIC void hmac_sha256_vector( uint8_t *key, size_t key_len, size_t num_elem,
              uint8_t *addr[],  size_t *len, uint8_t *mac);
@@ -41,6 +48,29 @@ VITA_TOOLCHAIN_PUBLIC void sha256_vector(size_t num_elem,  uint8_t *addr[],  siz
          uint8_t *mac);
 
 VITA_TOOLCHAIN_PUBLIC uint32_t sha256_32_vector(size_t num_elem, uint8_t *addr[],  size_t *len);
+
+/* NIDs of many short independent messages, such as the symbols of an export
+ * list, hashed several at a time when the CPU allows. The prefixed variant
+ * hashes prefix || msgs[i] for each message. */
+VITA_TOOLCHAIN_PUBLIC void sha256_32_batch(const uint8_t *const msgs[], const size_t lens[], size_t n, uint32_t nids[]);
+VITA_TOOLCHAIN_PUBLIC void sha256_32_batch_prefixed(const uint8_t *prefix, size_t prefix_len,
+         const uint8_t *const msgs[], const size_t lens[], size_t n, uint32_t nids[]);
+
+/* Running digest that can be read more than once: reading a hash finalizes a
+ * copy of the state, so more data can be added afterwards, and forking hashes
+ * a common prefix only once for several different tails. */
+typedef struct {
+   SHA256_CTX ctx;
+} sha256_digest;
+
+VITA_TOOLCHAIN_PUBLIC void sha256_digest_init(sha256_digest *digest);
+VITA_TOOLCHAIN_PUBLIC void sha256_digest_update(sha256_digest *digest, const void *data, size_t len);
+VITA_TOOLCHAIN_PUBLIC int sha256_digest_update_file(sha256_digest *digest, FILE *fp);
+VITA_TOOLCHAIN_PUBLIC void sha256_digest_fork(const sha256_digest *digest, sha256_digest *copy);
+VITA_TOOLCHAIN_PUBLIC void sha256_digest_hash(const sha256_digest *digest, uint8_t *mac);
+/* Module NID of the data so far, as sha256_32_file() computes it */
+VITA_TOOLCHAIN_PUBLIC uint32_t sha256_digest_module_nid(const sha256_digest *digest);
+
 VITA_TOOLCHAIN_PUBLIC int sha256_file(const char *file, uint8_t *mac);
 VITA_TOOLCHAIN_PUBLIC int sha256_32_file(const char *file, uint32_t *nid);
 
@@ -18,8 +18,9 @@ int parse_arguments(int argc, char *argv[], elf_create_args *arguments)
 	arguments->check_stub_count = 1;
 	arguments->is_test_stripping = 0;
 	arguments->is_bypass_stub_privilege_check = 0;
+	arguments->use_nid_cache = 1;
 
-	while ((c = getopt(argc, argv, "vne:sg:m:p")) != -1)
+	while ((c = getopt(argc, argv, "vne:sg:m:pN")) != -1)
 	{
 		switch (c)
 		{
@@ -44,6 +45,9 @@ int parse_arguments(int argc, char *argv[], elf_create_args *arguments)
 		case 'p':
 			arguments->is_bypass_stub_privilege_check = 1;
 			break;
+		case 'N':
+			arguments->use_nid_cache = 0;
+			break;
 		case '?':
 			fprintf(stderr, "unknown option -%c\n", optopt);
 			return -1;
@@ -14,6 +14,7 @@ typedef struct elf_create_args
 	int is_test_stripping;
 	char *entrypoint_funcs[3]; // module_start, module_stop, module_exit
 	int is_bypass_stub_privilege_check;
+	int use_nid_cache;
 } elf_create_args;
 
 
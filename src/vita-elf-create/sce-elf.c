@@ -8,7 +8,7 @@
 #include "vita-elf.h"
 #include "vita-export.h"
 #include "elf-defs.h"
-#include "elf-utils.h"
+#include "velf-writer.h"
 #include "sce-elf.h"
 #include "utils/fail-utils.h"
 #include "utils/varray.h"
@@ -98,39 +98,23 @@ static int _library_search(const void *key, const void *element)
 }
 
 static int get_function_by_symbol(const char *symbol, const vita_elf_t *ve, Elf32_Addr *vaddr) {
-	int i;
-	
-	for (i = 0; i < ve->num_symbols; ++i) {
-		if (ve->symtab[i].type != STT_FUNC)
-			continue;
-		
-		if (strcmp(ve->symtab[i].name, symbol) == 0) {
-			if (vaddr) {
-				*vaddr = ve->symtab[i].value;
-			}
-			break;
-		}
+	const vita_elf_symbol_t *sym = vita_elf_find_symbol(ve, symbol, STT_FUNC, NULL);
+
+	if (sym != NULL && vaddr) {
+		*vaddr = sym->value;
 	}
-	
-	return i != ve->num_symbols;
+
+	return sym != NULL;
 }
 
 int get_variable_by_symbol(const char *symbol, const vita_elf_t *ve, Elf32_Addr *vaddr) {
-	int i;
-	
-	for (i = 0; i < ve->num_symbols; ++i) {
-		if (ve->symtab[i].type != STT_OBJECT)
-			continue;
-		
-		if (strcmp(ve->symtab[i].name, symbol) == 0) {
-			if (vaddr) {
-				*vaddr = ve->symtab[i].value;
-			}
-			break;
-		}
+	const vita_elf_symbol_t *sym = vita_elf_find_symbol(ve, symbol, STT_OBJECT, NULL);
+
+	if (sym != NULL && vaddr) {
+		*vaddr = sym->value;
 	}
-	
-	return i != ve->num_symbols;
+
+	return sym != NULL;
 }
 
 typedef union {
@@ -1048,7 +1032,7 @@ failure:
 #undef ADDRELA
 
 int sce_elf_write_module_info(
-		Elf *dest, const vita_elf_t *ve, const sce_section_sizes_t *sizes, void *module_info)
+		velf_writer_t *dest, const vita_elf_t *ve, const sce_section_sizes_t *sizes, void *module_info)
 {
 	/* Corresponds to the order in sce_section_sizes_t */
 	static const char *section_names[] = {
@@ -1062,11 +1046,8 @@ int sce_elf_write_module_info(
 		".sceVNID.rodata",
 		".sceVStub.rodata"
 	};
-	GElf_Ehdr ehdr;
-	GElf_Shdr shdr;
-	GElf_Phdr phdr;
-	Elf_Scn *scn;
-	Elf_Data *data;
+	Elf32_Phdr *phdr;
+	velf_scn_t *scn;
 	sce_section_sizes_t section_addrs = {0};
 	int total_size = 0;
 	Elf32_Addr segment_base, start_vaddr;
@@ -1080,16 +1061,8 @@ int sce_elf_write_module_info(
 		total_size += ((Elf32_Word *)sizes)[i];
 	}
 
-	ELF_ASSERT(gelf_getehdr(dest, &ehdr));
-
-	for (segndx = 0; segndx < ve->num_segments; segndx++) {
-		if (ehdr.e_entry >= ve->segments[segndx].vaddr
-				&& ehdr.e_entry < ve->segments[segndx].vaddr + ve->segments[segndx].memsz)
-			break;
-	}
-	ASSERT(segndx < ve->num_segments);
-
-	ELF_ASSERT(gelf_getphdr(dest, segndx, &phdr));
+	segndx = vita_elf_vaddr_to_segndx(ve, dest->ehdr.e_entry);
+	ASSERT(segndx >= 0 && segndx < dest->num_phdrs);
 
 	segment_base = ve->segments[segndx].vaddr;
 	start_segoffset = ve->segments[segndx].memsz;
@@ -1097,45 +1070,35 @@ int sce_elf_write_module_info(
 	total_size += (start_segoffset - ve->segments[segndx].memsz); // add the padding size
 
 	start_vaddr = segment_base + start_segoffset;
-	start_foffset = phdr.p_offset + start_segoffset;
+	start_foffset = dest->phdrs[segndx].p_offset + start_segoffset;
 	cur_pos = 0;
 
-	if (!elf_utils_shift_contents(dest, start_foffset, total_size))
-		FAILX("Unable to relocate ELF sections");
+	velf_writer_shift_contents(dest, start_foffset, total_size);
 
 	/* Extend in our copy of phdrs so that vita_elf_vaddr_to_segndx can match it */
 	ve->segments[segndx].memsz += total_size;
 
-	phdr.p_filesz += total_size;
-	phdr.p_memsz += total_size;
-	ELF_ASSERT(gelf_update_phdr(dest, segndx, &phdr));
+	phdr = &dest->phdrs[segndx];
+	phdr->p_filesz += total_size;
+	phdr->p_memsz += total_size;
 
-	ELF_ASSERT(gelf_getehdr(dest, &ehdr));
-	ehdr.e_entry = ((segndx & 0x3) << 30) | start_segoffset;
-	ELF_ASSERT(gelf_update_ehdr(dest, &ehdr));
+	dest->ehdr.e_entry = ((segndx & 0x3) << 30) | start_segoffset;
 
 	for (i = 0; i < sizeof(sce_section_sizes_t) / sizeof(Elf32_Word); i++) {
 		int scn_size = ((Elf32_Word *)sizes)[i];
 		if (scn_size == 0)
 			continue;
 
-		scn = elf_utils_new_scn_with_name(dest, section_names[i]);
-		ELF_ASSERT(gelf_getshdr(scn, &shdr));
-		shdr.sh_type = SHT_PROGBITS;
-		shdr.sh_flags = SHF_ALLOC | SHF_EXECINSTR;
-		shdr.sh_addr = start_vaddr + cur_pos;
-		shdr.sh_offset = start_foffset + cur_pos;
-		shdr.sh_size = scn_size;
-		shdr.sh_addralign = 4;
-		ELF_ASSERT(gelf_update_shdr(scn, &shdr));
-
-		ELF_ASSERT(data = elf_newdata(scn));
-		data->d_buf = module_info + cur_pos;
-		data->d_type = ELF_T_BYTE;
-		data->d_version = EV_CURRENT;
-		data->d_size = scn_size;
-		data->d_off = 0;
-		data->d_align = 1;
+		scn = velf_writer_new_scn_with_name(dest, section_names[i]);
+		if (scn == NULL)
+			goto failure;
+		scn->shdr.sh_type = SHT_PROGBITS;
+		scn->shdr.sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+		scn->shdr.sh_addr = start_vaddr + cur_pos;
+		scn->shdr.sh_offset = start_foffset + cur_pos;
+		scn->shdr.sh_size = scn_size;
+		scn->shdr.sh_addralign = 4;
+		scn->buf = module_info + cur_pos;
 
 		cur_pos += scn_size;
 	}
@@ -1235,7 +1198,7 @@ int sce_elf_discard_invalid_relocs(const vita_elf_t *ve, vita_elf_rela_table_t *
 }
 
 int sce_elf_write_rela_sections(
-		Elf *dest, const vita_elf_t *ve, const vita_elf_rela_table_t *rtable)
+		velf_writer_t *dest, const vita_elf_t *ve, const vita_elf_rela_table_t *rtable)
 {
 	int total_relas = 0;
 	const vita_elf_rela_table_t *curtable;
@@ -1249,10 +1212,8 @@ int sce_elf_write_rela_sections(
 	Elf32_Word datseg, datoff;
 	int (*sce_rel_func)(SCE_Rel *, int, int, int, int, int);
 
-	Elf_Scn *scn;
-	GElf_Shdr shdr;
-	GElf_Phdr *phdrs;
-	size_t segment_count = 0;
+	velf_scn_t *scn;
+	Elf32_Phdr *phdr;
 
 	for (curtable = rtable; curtable; curtable = curtable->next)
 		total_relas += curtable->num_relas;
@@ -1290,31 +1251,20 @@ encode_relas:
 		}
 	}
 
-	scn = elf_utils_new_scn_with_data(dest, ".sce.rel", encoded_relas, curpos - encoded_relas);
+	scn = velf_writer_new_scn_with_data(dest, ".sce.rel", encoded_relas, curpos - encoded_relas);
+	encoded_relas = NULL;
 	if (scn == NULL)
 		goto failure;
-	encoded_relas = NULL;
 
-	ELF_ASSERT(gelf_getshdr(scn, &shdr));
-	shdr.sh_type = SHT_SCE_RELA;
-	shdr.sh_flags = 0;
-	shdr.sh_addralign = 4;
-	ELF_ASSERT(gelf_update_shdr(scn, &shdr));
+	scn->shdr.sh_type = SHT_SCE_RELA;
+	scn->shdr.sh_flags = 0;
+	scn->shdr.sh_addralign = 4;
 
-	ELF_ASSERT((elf_getphdrnum(dest, &segment_count), segment_count > 0));
-	ASSERT(phdrs = calloc(segment_count + 1, sizeof(GElf_Phdr)));
-	for (i = 0; i < segment_count; i++) {
-		ELF_ASSERT(gelf_getphdr(dest, i, phdrs + i));
-	}
-	ELF_ASSERT(gelf_newphdr(dest, segment_count + 1));
-	ELF_ASSERT(gelf_getphdr(dest, segment_count, phdrs + segment_count));
-	phdrs[segment_count].p_type = PT_SCE_RELA;
-	phdrs[segment_count].p_offset = shdr.sh_offset;
-	phdrs[segment_count].p_filesz = shdr.sh_size;
-	phdrs[segment_count].p_align = 16;
-	for (i = 0; i < segment_count + 1; i++) {
-		ELF_ASSERT(gelf_update_phdr(dest, i, phdrs + i));
-	}
+	ASSERT(phdr = velf_writer_new_phdr(dest));
+	phdr->p_type = PT_SCE_RELA;
+	phdr->p_offset = scn->shdr.sh_offset;
+	phdr->p_filesz = scn->shdr.sh_size;
+	phdr->p_align = 16;
 
 	return 1;
 
@@ -1360,37 +1310,33 @@ failure:
 	return 0;
 }
 
-int sce_elf_rewrite_stubs(Elf *dest, vita_elf_t *ve)
+int sce_elf_rewrite_stubs(velf_writer_t *dest, vita_elf_t *ve)
 {
-	Elf_Scn *scn, *symtab_scn;
-	GElf_Shdr shdr;
+	Elf_Scn *symtab_scn;
+	velf_scn_t *scn;
 	Elf_Data *data;
-	size_t shstrndx;
-	void *shstrtab;
 	uint32_t *stubdata;
 	int j, i;
 	int *cur_ndx;
 	char *sh_name, *stub_name;
 
-	ELF_ASSERT(elf_getshdrstrndx(dest, &shstrndx) == 0);
-	ELF_ASSERT(scn = elf_getscn(dest, shstrndx));
-	ELF_ASSERT(symtab_scn = elf_getscn(dest, ve->symtab_ndx));
-	ELF_ASSERT(data = elf_getdata(scn, NULL));
-	shstrtab = data->d_buf;
+	ASSERT(ve->symtab_ndx > 0 && ve->symtab_ndx < dest->num_scns);
+	ASSERT(symtab_scn = dest->scns[ve->symtab_ndx].src);
 
 	for(j=0;j<ve->fstubs_va.count;j++) {
 		cur_ndx = VARRAY_ELEMENT(&ve->fstubs_va,j);
-		ELF_ASSERT(scn = elf_getscn(dest, *cur_ndx));
-		ELF_ASSERT(gelf_getshdr(scn, &shdr));
+		ASSERT(*cur_ndx > 0 && *cur_ndx < dest->num_scns);
+		scn = &dest->scns[*cur_ndx];
+		ASSERT(scn->src != NULL);
 		
-		sh_name = shstrtab + shdr.sh_name;
+		sh_name = dest->shstrtab + scn->shdr.sh_name;
 		if (strstr(sh_name, ".vitalink.fstubs.") != sh_name)
 			errx(EXIT_FAILURE, "Your ELF file contains a malformed .vitalink.fstubs section. Please make sure all your stub libraries are up-to-date.");
 		stub_name = strrchr(sh_name, '.');
 		snprintf(sh_name, strlen(sh_name) + 1, ".text.fstubs%s", stub_name);
 		
 		data = NULL;
-		while ((data = elf_getdata(scn, data)) != NULL) {
+		while ((data = elf_getdata(scn->src, data)) != NULL) {
 			for (stubdata = (uint32_t *)data->d_buf;
 					(void *)stubdata < data->d_buf + data->d_size - 11; stubdata += 4) {
 				stubdata[0] = htole32(sce_elf_stub_func[0]);
@@ -1409,31 +1355,20 @@ int sce_elf_rewrite_stubs(Elf *dest, vita_elf_t *ve)
 	
 	for (j = ve->vstubs_va.count - 1; j >= 0; j--) {
 		cur_ndx = VARRAY_ELEMENT(&ve->vstubs_va,j);
-		ELF_ASSERT(scn = elf_getscn(dest, *cur_ndx));
-		ELF_ASSERT(gelf_getshdr(scn, &shdr));
-
-		/* Remove vstub section */
-		elfx_remscn(dest, scn);
 
-		/* Fixup shstrndx */
-		if (shstrndx > *cur_ndx)
-			elfx_update_shstrndx(dest, --shstrndx);
+		/* Remove vstub section, this also fixes up shstrndx */
+		if (!velf_writer_remove_scn(dest, *cur_ndx))
+			goto failure;
 
 		if (ve->symtab_ndx > *cur_ndx)
 			ve->symtab_ndx--;
 		
 		/* Fixup section index references */
-		scn = NULL;
-		while ((scn = elf_nextscn(dest, scn)) != NULL)
-		{
-			ELF_ASSERT(gelf_getshdr(scn, &shdr));
-
-			if (shdr.sh_link > *cur_ndx)
-				shdr.sh_link--;
-			if (shdr.sh_info > *cur_ndx)
-				shdr.sh_info--;
-
-			gelf_update_shdr(scn, &shdr);
+		for (i = 1; i < dest->num_scns; i++) {
+			if (dest->scns[i].shdr.sh_link > *cur_ndx)
+				dest->scns[i].shdr.sh_link--;
+			if (dest->scns[i].shdr.sh_info > *cur_ndx)
+				dest->scns[i].shdr.sh_info--;
 		}
 
 		/* Fixup symbol table section indices */
@@ -1452,16 +1387,7 @@ failure:
 	return 0;
 }
 
-int sce_elf_set_headers(FILE *destfile, const vita_elf_t *ve)
+void sce_elf_set_headers(velf_writer_t *dest, const vita_elf_t *ve)
 {
-	Elf32_Ehdr ehdr;
-
-	ehdr.e_type = htole16(ET_SCE_RELEXEC);
-
-	SYS_ASSERT(fseek(destfile, offsetof(Elf32_Ehdr, e_type), SEEK_SET));
-	SYS_ASSERT(fwrite(&ehdr.e_type, sizeof(ehdr.e_type), 1, destfile));
-
-	return 1;
-failure:
-	return 0;
+	dest->ehdr.e_type = ET_SCE_RELEXEC;
 }
@@ -2,6 +2,7 @@
 #define SCE_ELF_H
 
 #include "vita-elf.h"
+#include "velf-writer.h"
 
 /* SCE-specific definitions for e_type: */
 #define ET_SCE_EXEC         0xFE00		/* SCE Executable file */
@@ -127,15 +128,15 @@ void *sce_elf_module_info_encode(
 		vita_elf_rela_table_t *rtable, sce_module_params_t *params);
 
 int sce_elf_write_module_info(
-		Elf *dest, const vita_elf_t *ve, const sce_section_sizes_t *sizes, void *module_info);
+		velf_writer_t *dest, const vita_elf_t *ve, const sce_section_sizes_t *sizes, void *module_info);
 
 int sce_elf_discard_invalid_relocs(const vita_elf_t *ve, vita_elf_rela_table_t *rtable);
 
 int sce_elf_write_rela_sections(
-		Elf *dest, const vita_elf_t *ve, const vita_elf_rela_table_t *rtable);
+		velf_writer_t *dest, const vita_elf_t *ve, const vita_elf_rela_table_t *rtable);
 
-int sce_elf_rewrite_stubs(Elf *dest, vita_elf_t *ve);
+int sce_elf_rewrite_stubs(velf_writer_t *dest, vita_elf_t *ve);
 
-int sce_elf_set_headers(FILE *outfile, const vita_elf_t *ve);
+void sce_elf_set_headers(velf_writer_t *dest, const vita_elf_t *ve);
 
 #endif
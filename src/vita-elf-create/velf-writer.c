@@ -0,0 +1,532 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <libelf.h>
+#include <gelf.h>
+
+#ifndef __MINGW32__
+#include <sys/uio.h>
+#else
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#include "utils/fail-utils.h"
+#include "utils/varray.h"
+#include "velf-writer.h"
+
+/* A run of bytes placed at a fixed file offset */
+typedef struct {
+	Elf32_Off offset;
+	const void *buf;
+	size_t size;
+} velf_extent_t;
+
+static int _extent_sort(const void *el1, const void *el2)
+{
+	const velf_extent_t *ext1 = el1, *ext2 = el2;
+	if (ext1->offset > ext2->offset)
+		return 1;
+	else if (ext1->offset < ext2->offset)
+		return -1;
+	return 0;
+}
+
+static const char zero_fill[4096];
+
+velf_writer_t *velf_writer_new(Elf *source)
+{
+	velf_writer_t *w = NULL;
+	Elf32_Ehdr *ehdr;
+	Elf32_Shdr *shdr;
+	Elf32_Phdr *phdrs;
+	Elf_Scn *scn;
+	Elf_Data *data;
+	size_t segment_count, segndx;
+	int scndx;
+
+	ASSERT(w = calloc(1, sizeof(velf_writer_t)));
+
+	ELF_ASSERT(ehdr = elf32_getehdr(source));
+	w->ehdr = *ehdr;
+
+	/* Section 0 stays all zeroes */
+	scn = NULL;
+	w->num_scns = 1;
+	while ((scn = elf_nextscn(source, scn)) != NULL)
+		w->num_scns++;
+	ASSERT(w->scns = calloc(w->num_scns, sizeof(velf_scn_t)));
+
+	scn = NULL;
+	scndx = 1;
+	while ((scn = elf_nextscn(source, scn)) != NULL) {
+		ELF_ASSERT(shdr = elf32_getshdr(scn));
+		w->scns[scndx].shdr = *shdr;
+		w->scns[scndx].src = scn;
+		scndx++;
+	}
+
+	/* Only PT_LOAD segments make it to the output */
+	ELF_ASSERT(elf_getphdrnum(source, &segment_count) == 0);
+	ELF_ASSERT(phdrs = elf32_getphdr(source));
+	ASSERT(w->phdrs = calloc(segment_count + 1, sizeof(Elf32_Phdr)));
+	for (segndx = 0; segndx < segment_count; segndx++) {
+		if (phdrs[segndx].p_type == PT_LOAD)
+			w->phdrs[w->num_phdrs++] = phdrs[segndx];
+	}
+	ASSERT(w->num_phdrs > 0);
+
+	ASSERT(w->ehdr.e_shstrndx > 0 && w->ehdr.e_shstrndx < w->num_scns);
+	ELF_ASSERT(data = elf_getdata(w->scns[w->ehdr.e_shstrndx].src, NULL));
+	ASSERT(w->shstrtab = malloc(data->d_size));
+	memcpy(w->shstrtab, data->d_buf, data->d_size);
+	w->shstrtab_size = data->d_size;
+	w->scns[w->ehdr.e_shstrndx].src = NULL;
+	w->scns[w->ehdr.e_shstrndx].buf = w->shstrtab;
+
+	return w;
+failure:
+	velf_writer_free(w);
+	return NULL;
+}
+
+void velf_writer_free(velf_writer_t *w)
+{
+	int i;
+
+	if (w == NULL)
+		return;
+
+	for (i = 0; i < w->num_scns; i++)
+		free(w->scns[i].owned_buf);
+	free(w->scns);
+	free(w->phdrs);
+	free(w->shstrtab);
+	free(w);
+}
+
+void velf_writer_shift_contents(velf_writer_t *w, Elf32_Off start_offset, Elf32_Word shift_amount)
+{
+	Elf32_Shdr *shdr;
+	Elf32_Off bottom_section_offset = 0;
+	Elf32_Word sh_size;
+	int i;
+
+	if (w->ehdr.e_shoff >= start_offset)
+		w->ehdr.e_shoff += shift_amount;
+
+	for (i = 1; i < w->num_scns; i++) {
+		shdr = &w->scns[i].shdr;
+		if (shdr->sh_offset >= start_offset)
+			shdr->sh_offset += shift_amount;
+		sh_size = (shdr->sh_type == SHT_NOBITS) ? 0 : shdr->sh_size;
+		if (shdr->sh_offset + sh_size > bottom_section_offset)
+			bottom_section_offset = shdr->sh_offset + sh_size;
+	}
+
+	if (bottom_section_offset > w->ehdr.e_shoff)
+		w->ehdr.e_shoff = bottom_section_offset;
+
+	for (i = 0; i < w->num_phdrs; i++) {
+		if (w->phdrs[i].p_offset >= start_offset)
+			w->phdrs[i].p_offset += shift_amount;
+	}
+}
+
+velf_scn_t *velf_writer_new_scn_with_name(velf_writer_t *w, const char *scn_name)
+{
+	velf_scn_t *scn, *shstrscn;
+	size_t index, namelen;
+	char *ptr;
+
+	shstrscn = &w->scns[w->ehdr.e_shstrndx];
+
+	namelen = strlen(scn_name) + 1;
+	velf_writer_shift_contents(w, shstrscn->shdr.sh_offset + shstrscn->shdr.sh_size, namelen);
+	ASSERT(ptr = realloc(w->shstrtab, w->shstrtab_size + namelen));
+	index = w->shstrtab_size;
+	strcpy(ptr + index, scn_name);
+	w->shstrtab = ptr;
+	w->shstrtab_size += namelen;
+	shstrscn->buf = w->shstrtab;
+	shstrscn->shdr.sh_size += namelen;
+
+	ASSERT(scn = realloc(w->scns, (w->num_scns + 1) * sizeof(velf_scn_t)));
+	w->scns = scn;
+	scn = &w->scns[w->num_scns++];
+	memset(scn, 0, sizeof(velf_scn_t));
+	scn->shdr.sh_name = index;
+
+	return scn;
+failure:
+	return NULL;
+}
+
+velf_scn_t *velf_writer_new_scn_with_data(velf_writer_t *w, const char *scn_name, void *buf, int len)
+{
+	velf_scn_t *scn;
+	Elf32_Off offset;
+
+	scn = velf_writer_new_scn_with_name(w, scn_name);
+	if (scn == NULL)
+		goto failure;
+
+	offset = w->ehdr.e_shoff;
+	velf_writer_shift_contents(w, offset, len + 0x10);
+
+	scn->shdr.sh_offset = (offset + 0x10) & ~0xF;
+	scn->shdr.sh_size = len;
+	scn->shdr.sh_addralign = 1;
+	scn->buf = buf;
+	scn->owned_buf = buf;
+
+	return scn;
+failure:
+	free(buf);
+	return NULL;
+}
+
+int velf_writer_remove_scn(velf_writer_t *w, int scndx)
+{
+	ASSERT(scndx > 0 && scndx < w->num_scns && scndx != w->ehdr.e_shstrndx);
+
+	free(w->scns[scndx].owned_buf);
+	memmove(&w->scns[scndx], &w->scns[scndx + 1], (w->num_scns - scndx - 1) * sizeof(velf_scn_t));
+	w->num_scns--;
+
+	if (w->ehdr.e_shstrndx > scndx)
+		w->ehdr.e_shstrndx--;
+
+	return 1;
+failure:
+	return 0;
+}
+
+Elf32_Phdr *velf_writer_new_phdr(velf_writer_t *w)
+{
+	Elf32_Phdr *phdrs;
+
+	ASSERT(phdrs = realloc(w->phdrs, (w->num_phdrs + 1) * sizeof(Elf32_Phdr)));
+	w->phdrs = phdrs;
+	memset(&w->phdrs[w->num_phdrs], 0, sizeof(Elf32_Phdr));
+
+	return &w->phdrs[w->num_phdrs++];
+failure:
+	return NULL;
+}
+
+/* Convert count headers or entries of the given type to their little-endian file representation */
+static void *to_file_format(const void *buf, size_t size, Elf_Type type)
+{
+	Elf_Data src = {0}, dst = {0};
+
+	src.d_buf = (void *)buf;
+	src.d_type = type;
+	src.d_size = size;
+	src.d_version = EV_CURRENT;
+
+	dst.d_buf = malloc(size);
+	dst.d_size = size;
+	dst.d_version = EV_CURRENT;
+	if (dst.d_buf == NULL)
+		return NULL;
+
+	if (elf32_xlatetof(&dst, &src, ELFDATA2LSB) == NULL) {
+		free(dst.d_buf);
+		return NULL;
+	}
+
+	return dst.d_buf;
+}
+
+static int push_extent(varray *extents, varray *owned, Elf32_Off offset, const void *buf, size_t size, Elf_Type type)
+{
+	velf_extent_t ext;
+	void *converted;
+
+	if (size == 0)
+		return 1;
+
+	if (type != ELF_T_BYTE) {
+		ELF_ASSERT(converted = to_file_format(buf, size, type));
+		ASSERT(varray_push(owned, &converted));
+		buf = converted;
+	}
+
+	ext.offset = offset;
+	ext.buf = buf;
+	ext.size = size;
+	ASSERT(varray_push(extents, &ext));
+
+	return 1;
+failure:
+	return 0;
+}
+
+static int write_iovecs(FILE *file, struct iovec *iov, int iovcnt)
+{
+#ifndef __MINGW32__
+	ssize_t written;
+	int count;
+
+	while (iovcnt > 0) {
+		count = iovcnt < IOV_MAX ? iovcnt : IOV_MAX;
+		written = writev(fileno(file), iov, count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return 0;
+		}
+
+		/* Skip what has been written, a short write may stop in the middle of a vector */
+		while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (written > 0) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+#else
+	for (; iovcnt > 0; iov++, iovcnt--) {
+		if (iov->iov_len != 0 && fwrite(iov->iov_base, iov->iov_len, 1, file) != 1)
+			return 0;
+	}
+#endif
+
+	return 1;
+}
+
+static int push_iovec(varray *iovecs, const void *buf, size_t size)
+{
+	struct iovec iov;
+
+	iov.iov_base = (void *)buf;
+	iov.iov_len = size;
+
+	return varray_push(iovecs, &iov) != NULL;
+}
+
+static int push_zero_fill(varray *iovecs, size_t size)
+{
+	size_t chunk;
+
+	while (size > 0) {
+		chunk = size < sizeof(zero_fill) ? size : sizeof(zero_fill);
+		if (!push_iovec(iovecs, zero_fill, chunk))
+			return 0;
+		size -= chunk;
+	}
+
+	return 1;
+}
+
+/* Push the bytes of the laid out file within [start, end), zero filling the holes */
+static int push_window(varray *iovecs, const varray *extents, Elf32_Off start, Elf32_Off end)
+{
+	const velf_extent_t *ext;
+	Elf32_Off pos = start, ext_start, ext_end;
+	int i;
+
+	for (i = 0; i < extents->count && pos < end; i++) {
+		ext = VARRAY_ELEMENT(extents, i);
+		ext_start = ext->offset;
+		ext_end = ext->offset + ext->size;
+		if (ext_end <= pos)
+			continue;
+		if (ext_start >= end)
+			break;
+
+		if (ext_start > pos) {
+			if (!push_zero_fill(iovecs, ext_start - pos))
+				return 0;
+			pos = ext_start;
+		}
+		if (ext_end > end)
+			ext_end = end;
+		if (!push_iovec(iovecs, (const char *)ext->buf + (pos - ext_start), ext_end - pos))
+			return 0;
+		pos = ext_end;
+	}
+
+	if (end > pos)
+		return push_zero_fill(iovecs, end - pos);
+
+	return 1;
+}
+
+/* Headers and segments only: the program headers follow the ELF header and
+ * each segment is packed at the next offset matching its alignment */
+static int push_stripped(varray *iovecs, varray *owned, const velf_writer_t *w, const varray *extents)
+{
+	Elf32_Ehdr ehdr;
+	Elf32_Phdr *phdrs = NULL;
+	Elf32_Off seg_offset, pos;
+	void *converted;
+	int i;
+
+	ehdr = w->ehdr;
+	ehdr.e_shoff = 0;
+	ehdr.e_shentsize = 0;
+	ehdr.e_shnum = 0;
+	ehdr.e_shstrndx = 0;
+	ehdr.e_phoff = ehdr.e_ehsize;
+
+	ASSERT(phdrs = calloc(w->num_phdrs + 1, sizeof(Elf32_Phdr)));
+	memcpy(phdrs, w->phdrs, w->num_phdrs * sizeof(Elf32_Phdr));
+
+	seg_offset = ehdr.e_ehsize + w->num_phdrs * sizeof(Elf32_Phdr);
+	for (i = 0; i < w->num_phdrs; i++) {
+		/* vita only accepts 0x10 to 0x1000 alignments */
+		if (phdrs[i].p_align > 0x1000)
+			phdrs[i].p_align = 0x10; // vita elf default align
+
+		if (phdrs[i].p_align > 1)
+			seg_offset = (seg_offset + (phdrs[i].p_align - 1)) & ~(phdrs[i].p_align - 1);
+		phdrs[i].p_offset = seg_offset;
+		seg_offset += phdrs[i].p_filesz;
+	}
+
+	ELF_ASSERT(converted = to_file_format(&ehdr, sizeof(Elf32_Ehdr), ELF_T_EHDR));
+	ASSERT(varray_push(owned, &converted));
+	ASSERT(push_iovec(iovecs, converted, sizeof(Elf32_Ehdr)));
+	ELF_ASSERT(converted = to_file_format(phdrs, w->num_phdrs * sizeof(Elf32_Phdr), ELF_T_PHDR));
+	ASSERT(varray_push(owned, &converted));
+	ASSERT(push_iovec(iovecs, converted, w->num_phdrs * sizeof(Elf32_Phdr)));
+
+	pos = ehdr.e_ehsize + w->num_phdrs * sizeof(Elf32_Phdr);
+	for (i = 0; i < w->num_phdrs; i++) {
+		if (phdrs[i].p_filesz == 0)
+			continue;
+		ASSERT(push_zero_fill(iovecs, phdrs[i].p_offset - pos));
+		ASSERT(push_window(iovecs, extents, w->phdrs[i].p_offset, w->phdrs[i].p_offset + w->phdrs[i].p_filesz));
+		pos = phdrs[i].p_offset + phdrs[i].p_filesz;
+	}
+
+	free(phdrs);
+	return 1;
+failure:
+	free(phdrs);
+	return 0;
+}
+
+int velf_writer_write(velf_writer_t *w, const char *filename)
+{
+	varray extents = {0}, owned = {0}, iovecs = {0};
+	velf_extent_t *ext;
+	Elf32_Shdr *shdrs = NULL;
+	Elf32_Shdr *shdr;
+	velf_scn_t *scn;
+	Elf_Data *data;
+	Elf32_Off file_size, pos, end;
+	FILE *file = NULL;
+	int res = 0;
+	int i;
+
+	ASSERT(varray_init(&extents, sizeof(velf_extent_t), 64));
+	extents.sort_compar = _extent_sort;
+	ASSERT(varray_init(&owned, sizeof(void *), 8));
+	ASSERT(varray_init(&iovecs, sizeof(struct iovec), 64));
+
+	w->ehdr.e_ident[EI_MAG0] = ELFMAG0;
+	w->ehdr.e_ident[EI_MAG1] = ELFMAG1;
+	w->ehdr.e_ident[EI_MAG2] = ELFMAG2;
+	w->ehdr.e_ident[EI_MAG3] = ELFMAG3;
+	w->ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+	w->ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+	w->ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+	w->ehdr.e_version = EV_CURRENT;
+	w->ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+	w->ehdr.e_phnum = w->num_phdrs;
+	w->ehdr.e_phentsize = w->num_phdrs ? sizeof(Elf32_Phdr) : 0;
+	w->ehdr.e_shnum = w->num_scns;
+	w->ehdr.e_shentsize = sizeof(Elf32_Shdr);
+
+	file_size = sizeof(Elf32_Ehdr);
+	if (!push_extent(&extents, &owned, 0, &w->ehdr, sizeof(Elf32_Ehdr), ELF_T_EHDR))
+		goto failure;
+
+	end = w->ehdr.e_phoff + w->num_phdrs * sizeof(Elf32_Phdr);
+	if (end > file_size)
+		file_size = end;
+	if (!push_extent(&extents, &owned, w->ehdr.e_phoff, w->phdrs, w->num_phdrs * sizeof(Elf32_Phdr), ELF_T_PHDR))
+		goto failure;
+
+	ASSERT(shdrs = calloc(w->num_scns, sizeof(Elf32_Shdr)));
+	for (i = 1; i < w->num_scns; i++) {
+		scn = &w->scns[i];
+		shdr = &scn->shdr;
+		shdrs[i] = *shdr;
+
+		if (shdr->sh_type == SHT_NULL || shdr->sh_type == SHT_NOBITS)
+			continue;
+
+		end = shdr->sh_offset + shdr->sh_size;
+		if (end > file_size)
+			file_size = end;
+
+		if (scn->src == NULL) {
+			if (!push_extent(&extents, &owned, shdr->sh_offset, scn->buf, shdr->sh_size, ELF_T_BYTE))
+				goto failure;
+			continue;
+		}
+
+		data = NULL;
+		while ((data = elf_getdata(scn->src, data)) != NULL) {
+			if (!push_extent(&extents, &owned, shdr->sh_offset + data->d_off, data->d_buf, data->d_size, data->d_type))
+				goto failure;
+		}
+	}
+
+	end = w->ehdr.e_shoff + w->num_scns * sizeof(Elf32_Shdr);
+	if (end > file_size)
+		file_size = end;
+	if (!push_extent(&extents, &owned, w->ehdr.e_shoff, shdrs, w->num_scns * sizeof(Elf32_Shdr), ELF_T_SHDR))
+		goto failure;
+
+	varray_sort(&extents);
+	pos = 0;
+	for (i = 0; i < extents.count; i++) {
+		ext = VARRAY_ELEMENT(&extents, i);
+		if (ext->offset < pos)
+			FAILX("Output contents overlap at offset 0x%x", ext->offset);
+		pos = ext->offset + ext->size;
+	}
+
+	/* Segments are copied straight out of the full layout when stripping, so
+	 * the section headers never reach the disk */
+	if (w->strip_sections) {
+		if (!push_stripped(&iovecs, &owned, w, &extents))
+			goto failure;
+	} else if (!push_window(&iovecs, &extents, 0, file_size)) {
+		FAILX("Could not allocate output vectors");
+	}
+
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		FAIL("Could not open %s for writing", filename);
+
+	if (!write_iovecs(file, iovecs.data, iovecs.count))
+		FAIL("Could not write %s", filename);
+
+	res = 1;
+failure:
+	if (file != NULL)
+		fclose(file);
+	for (i = 0; i < owned.count; i++)
+		free(*(void **)VARRAY_ELEMENT(&owned, i));
+	varray_destroy(&owned);
+	varray_destroy(&extents);
+	varray_destroy(&iovecs);
+	free(shdrs);
+	return res;
+}
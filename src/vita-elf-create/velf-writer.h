@@ -0,0 +1,54 @@
+#ifndef VELF_WRITER_H
+#define VELF_WRITER_H
+
+#include <stdio.h>
+#include <libelf.h>
+
+/* In-memory layout of the output velf.
+ *
+ * The ELF, section and program headers are kept as plain arrays, so adding
+ * sections and moving contents around never touches libelf.  Nothing is
+ * written until velf_writer_write(), which emits the whole file in offset
+ * order in a single pass. */
+
+typedef struct velf_scn_t {
+	Elf32_Shdr shdr;
+	Elf_Scn *src;		/* Input section holding the contents, NULL for new sections */
+	const void *buf;	/* Contents of a new section */
+	void *owned_buf;	/* Freed along with the writer */
+} velf_scn_t;
+
+typedef struct velf_writer_t {
+	Elf32_Ehdr ehdr;
+
+	velf_scn_t *scns;
+	int num_scns;
+
+	Elf32_Phdr *phdrs;
+	int num_phdrs;
+
+	/* Private copy of the section name table, which grows with every new section */
+	char *shstrtab;
+	size_t shstrtab_size;
+
+	/* Emit only the headers and segments, packed after each other */
+	int strip_sections;
+} velf_writer_t;
+
+/* Start from the sections and PT_LOAD segments of source, at their current offsets */
+velf_writer_t *velf_writer_new(Elf *source);
+void velf_writer_free(velf_writer_t *w);
+
+void velf_writer_shift_contents(velf_writer_t *w, Elf32_Off start_offset, Elf32_Word shift_amount);
+
+/* The returned pointers stay valid until the next section is added or removed */
+velf_scn_t *velf_writer_new_scn_with_name(velf_writer_t *w, const char *scn_name);
+/* buf is owned by the writer afterwards */
+velf_scn_t *velf_writer_new_scn_with_data(velf_writer_t *w, const char *scn_name, void *buf, int len);
+int velf_writer_remove_scn(velf_writer_t *w, int scndx);
+
+Elf32_Phdr *velf_writer_new_phdr(velf_writer_t *w);
+
+int velf_writer_write(velf_writer_t *w, const char *filename);
+
+#endif
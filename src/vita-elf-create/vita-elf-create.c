@@ -13,10 +13,10 @@
 #include "vita-export.h"
 #include "elf-defs.h"
 #include "sce-elf.h"
-#include "elf-utils.h"
 #include "utils/fail-utils.h"
 #include "elf-create-argp.h"
 #include "utils/yamlemitter.h"
+#include "utils/nid-cache.h"
 #include "../vita-libs-gen-2/defs.h"
 
 // logging level
@@ -117,158 +117,6 @@ void list_segments(vita_elf_t *ve)
 	}
 }
 
-int vita_elf_packing(const char *velf_path, const vita_export_t *exports)
-{
-	int res;
-	char tmp[PATH_MAX];
-
-	int velf_path_length = strnlen(velf_path, PATH_MAX);
-	if (velf_path_length >= (PATH_MAX - 4))
-		return -1;
-
-	snprintf(tmp, sizeof(tmp), "%s.tmp", velf_path);
-
-	FILE *fd_src, *fd_dst;
-
-	fd_src = fopen(velf_path, "rb");
-	if (fd_src == NULL)
-		return -1;
-
-	fd_dst = fopen(tmp, "wb");
-	if (fd_dst == NULL) {
-		res = -1;
-		goto end_io_close_src;
-	}
-
-	void *elf_header = NULL;
-
-	elf_header = malloc(0x100);
-	if (elf_header == NULL) {
-		res = -1;
-		goto end_io_close_dst;
-	}
-
-	/*
-	 * Read elf header
-	 */
-	if (fread(elf_header, 0x100, 1, fd_src) != 1) {
-		res = -1;
-		goto end_free_elf_header;
-	}
-
-	Elf32_Ehdr *pEhdr = (Elf32_Ehdr *)elf_header;
-
-	/*
-	 * Remove section entrys
-	 */
-	pEhdr->e_shoff     = 0;
-	pEhdr->e_shentsize = 0;
-	pEhdr->e_shnum     = 0;
-	pEhdr->e_shstrndx  = 0;
-
-	Elf32_Phdr *pPhdr, *pPhdrTmp;
-
-	pPhdr = (Elf32_Phdr *)(elf_header + pEhdr->e_phoff);
-
-	/*
-	 * Packed ehdr and phdr
-	 */
-	if (pEhdr->e_phoff != pEhdr->e_ehsize) {
-		pPhdrTmp = malloc(pEhdr->e_phentsize * pEhdr->e_phnum);
-
-		memcpy(pPhdrTmp, pPhdr, pEhdr->e_phentsize * pEhdr->e_phnum);
-
-		memset(elf_header + pEhdr->e_ehsize, 0, 0x100 - pEhdr->e_ehsize);
-		memcpy(elf_header + pEhdr->e_ehsize, pPhdrTmp, pEhdr->e_phentsize * pEhdr->e_phnum);
-
-		free(pPhdrTmp);
-
-		pEhdr->e_phoff = pEhdr->e_ehsize;
-		pPhdr = (Elf32_Phdr *)(elf_header + pEhdr->e_phoff);
-	}
-
-	long seg_offset = pEhdr->e_ehsize + (pEhdr->e_phentsize * pEhdr->e_phnum);
-
-	/*
-	 * Write packed elf header
-	 */
-	fseek(fd_dst, 0, SEEK_SET);
-	if (fwrite(elf_header, seg_offset, 1, fd_dst) != 1) {
-		res = -1;
-		goto end_free_elf_header;
-	}
-
-	void *seg_tmp;
-
-	/*
-	 * Write elf segments
-	 */
-	for (int i=0;i<pEhdr->e_phnum;i++) {
-
-		/*
-		 * vita only accepts 0x10 to 0x1000 alignments
-		 */
-		if (pPhdr[i].p_align > 0x1000) {
-			pPhdr[i].p_align = 0x10; // vita elf default align
-		}
-
-		seg_offset = (seg_offset + (pPhdr[i].p_align - 1)) & ~(pPhdr[i].p_align - 1);
-
-		if (pPhdr[i].p_filesz != 0) {
-			seg_tmp = malloc(pPhdr[i].p_filesz);
-
-			fseek(fd_dst, seg_offset, SEEK_SET);
-			fseek(fd_src, pPhdr[i].p_offset, SEEK_SET);
-
-			if (fread(seg_tmp, pPhdr[i].p_filesz, 1, fd_src) != 1) {
-				free(seg_tmp);
-				res = -1;
-				goto end_free_elf_header;
-			}
-
-			if (fwrite(seg_tmp, pPhdr[i].p_filesz, 1, fd_dst) != 1) {
-				free(seg_tmp);
-				res = -1;
-				goto end_free_elf_header;
-			}
-
-			free(seg_tmp);
-			seg_tmp = NULL;
-		}
-
-		pPhdr[i].p_offset = seg_offset;
-		seg_offset += pPhdr[i].p_filesz;
-	}
-
-	seg_offset = pEhdr->e_ehsize + (pEhdr->e_phentsize * pEhdr->e_phnum);
-
-	/*
-	 * Write updated elf header
-	 */
-	fseek(fd_dst, 0, SEEK_SET);
-	if (fwrite(elf_header, seg_offset, 1, fd_dst) != 1) {
-		res = -1;
-		goto end_free_elf_header;
-	}
-
-	remove(velf_path);
-	rename(tmp, velf_path);
-
-	res = 0;
-
-end_free_elf_header:
-	free(elf_header);
-
-end_io_close_dst:
-	fclose(fd_dst);
-
-end_io_close_src:
-	fclose(fd_src);
-
-	return res;
-}
-
-
 static char* hextostr(int x){
 	static char buf[20];
 	sprintf(buf,"0x%x",x);
@@ -471,7 +319,7 @@ error:
 
 static int usage(int argc, char *argv[])
 {
-	fprintf(stderr, "usage: %s [-v|vv|vvv] [-s] [-n] [[-e | -g] config.yml] [-l <long_name_option>] [-m start,stop,exit] input.elf output.velf\n"
+	fprintf(stderr, "usage: %s [-v|vv|vvv] [-s] [-n] [-N] [[-e | -g] config.yml] [-l <long_name_option>] [-m start,stop,exit] input.elf output.velf\n"
 					"\t-v,-vv,-vvv:    logging verbosity (more v is more verbose)\n"
 					"\t-s         :    strip the output ELF\n"
 					"\t-n         :    allow empty imports\n"
@@ -479,6 +327,7 @@ static int usage(int argc, char *argv[])
 					"\t-g yml     :    generate an export config from ELF symbols\n"
 					"\t-m list    :    specify the list of module entrypoints\n"
 					"\t-p         :    skip stub privilege check\n"
+					"\t-N         :    don't use the NID cache named by $" NID_CACHE_ENV "\n"
 					"\tinput.elf  :    input ARM ET_EXEC type ELF\n"
 					"\toutput.velf:    output ET_SCE_RELEXEC type ELF\n", argc > 0 ? argv[0] : "vita-elf-create");
 	return 0;
@@ -504,6 +353,9 @@ int main(int argc, char *argv[])
 
 	g_log = args.log_level;
 
+	if (args.use_nid_cache)
+		nid_cache_open_default();
+
 	if (args.exports) {
 		exports = vita_exports_load(args.exports, args.input, 0);		
 		if (!exports)
@@ -536,6 +388,10 @@ int main(int argc, char *argv[])
 		TRACEF(VERBOSE, "export config loaded from default\n");
 	}
 
+	// every export NID is known by now
+	if (nid_cache_close() > 0)
+		status = EXIT_FAILURE;
+
 	/*
 	 * FIXME
 	 * Since packages such as taihen have a pre-built taihenForKernel_stub.a, this check always fails.
@@ -597,6 +453,8 @@ int main(int argc, char *argv[])
 	TRACEF(VERBOSE, "Relocations:\n");
 	list_rels(ve);
 
+	TRACEF(DEBUG, "vstub relocation lookup: %.3f ms\n", ve->vstub_relas_time * 1000.0 / CLOCKS_PER_SEC);
+
 	TRACEF(VERBOSE, "Segments:\n");
 	list_segments(ve);
 
@@ -655,26 +513,21 @@ int main(int argc, char *argv[])
 	TRACEF(VERBOSE, "Relocations from encoded modinfo:\n");
 	print_rtable(&rtable);
 
-	FILE *outfile;
-	Elf *dest;
-	ASSERT(dest = elf_utils_copy_to_file(args.output, ve->elf, &outfile));
-	ASSERT(elf_utils_duplicate_shstrtab(dest));
+	velf_writer_t *dest;
+	ASSERT(dest = velf_writer_new(ve->elf));
+	dest->strip_sections = args.is_test_stripping;
 	ASSERT(sce_elf_discard_invalid_relocs(ve, ve->rela_tables));
 	ASSERT(sce_elf_write_module_info(dest, ve, &section_sizes, encoded_modinfo));
 	rtable.next = ve->rela_tables;
 	ASSERT(sce_elf_write_rela_sections(dest, ve, &rtable));
 	ASSERT(sce_elf_rewrite_stubs(dest, ve));
-	ELF_ASSERT(elf_update(dest, ELF_C_WRITE) >= 0);
-	elf_end(dest);
-	ASSERT(sce_elf_set_headers(outfile, ve));
-	fclose(outfile);
+	sce_elf_set_headers(dest, ve);
+	ASSERT(velf_writer_write(dest, args.output));
+	velf_writer_free(dest);
 
 	if (args.exports_output)
 		write_exports(exports, args.exports_output);
 
-	if (args.is_test_stripping != 0)
-		vita_elf_packing(args.output, exports);
-
 	/* FIXME: restore original segment sizes */
 	for(idx = 0; idx < ve->num_segments; idx++)
 		ve->segments[idx].memsz = segment_sizes[idx];
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <libelf.h>
 #include <gelf.h>
@@ -22,6 +23,9 @@
  * to mmap() that we can explore later.  It'll probably work under Cygwin.
  */
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_FILE_MMAP
 #else
 #define mmap(ptr,size,c,d,e,f) malloc(size)
 #define munmap(ptr, size) free(ptr)
@@ -34,16 +38,66 @@
 #include "utils/fail-utils.h"
 #include "utils/endian-utils.h"
 #include "utils/sha256.h"
+#include "utils/nid-cache.h"
 #include "vita-export.h"
 #include "sce-elf.h"
 
 static void free_rela_table(vita_elf_rela_table_t *rtable);
 
+static int _scn_range_sort(const void *el1, const void *el2)
+{
+	const vita_elf_scn_range_t *range1 = el1, *range2 = el2;
+	if (range1->addr > range2->addr)
+		return 1;
+	else if (range1->addr < range2->addr)
+		return -1;
+	return 0;
+}
+
+static int _scn_range_search(const void *key, const void *element)
+{
+	const Elf32_Addr *vaddr = key;
+	const vita_elf_scn_range_t *range = element;
+	if (*vaddr < range->addr)
+		return -1;
+	else if (*vaddr - range->addr >= range->size)
+		return 1;
+	return 0;
+}
+
+static int _seg_range_sort(const void *el1, const void *el2)
+{
+	const vita_elf_segment_info_t *seg1 = *(vita_elf_segment_info_t * const *)el1;
+	const vita_elf_segment_info_t *seg2 = *(vita_elf_segment_info_t * const *)el2;
+	if (seg1->vaddr > seg2->vaddr)
+		return 1;
+	else if (seg1->vaddr < seg2->vaddr)
+		return -1;
+	return 0;
+}
+
+static int _seg_range_search(const void *key, const void *element)
+{
+	const Elf32_Addr *vaddr = key;
+	const vita_elf_segment_info_t *seg = *(vita_elf_segment_info_t * const *)element;
+	if (*vaddr < seg->vaddr)
+		return -1;
+	else if (*vaddr - seg->vaddr >= seg->memsz)
+		return 1;
+	return 0;
+}
+
+static const vita_elf_segment_info_t *lookup_segment(const vita_elf_t *ve, Elf32_Addr vaddr)
+{
+	vita_elf_segment_info_t **seg = varray_sorted_search(&ve->seg_ranges, &vaddr);
+
+	return seg != NULL ? *seg : NULL;
+}
+
 static int fixup_vstub_rela(vita_elf_t *ve, uint8_t *code, Elf32_Addr rel_vaddr)
 {
-	Elf_Scn *scn = NULL;
+	vita_elf_scn_range_t *range;
 	Elf_Data *data = NULL;
-	GElf_Shdr shdr;
 	union {
 		Elf32_Word arm;
 		Elf32_Half thumb[2];
@@ -51,17 +105,14 @@ static int fixup_vstub_rela(vita_elf_t *ve, uint8_t *code, Elf32_Addr rel_vaddr)
 	void *rel_addr = NULL;
 	Elf32_Word rel_offset;
 
-	while ((scn = elf_nextscn(ve->elf, scn)) != NULL) {
-		ELF_ASSERT(gelf_getshdr(scn, &shdr) == &shdr);
-		if ((shdr.sh_addr <= rel_vaddr) && (rel_vaddr < shdr.sh_addr + shdr.sh_size)) {
-			rel_offset = rel_vaddr - shdr.sh_addr;
-			while ((data = elf_getdata(scn, data)) != NULL) {
-				if ((data->d_off <= rel_offset) && (rel_offset < data->d_off + data->d_size)) {
-					rel_addr = data->d_buf + (rel_offset - data->d_off);
-					break;
-				}
+	range = varray_sorted_search(&ve->scn_ranges, &rel_vaddr);
+	if (range != NULL) {
+		rel_offset = rel_vaddr - range->addr;
+		while ((data = elf_getdata(range->scn, data)) != NULL) {
+			if ((data->d_off <= rel_offset) && (rel_offset < data->d_off + data->d_size)) {
+				rel_addr = data->d_buf + (rel_offset - data->d_off);
+				break;
 			}
-			break;
 		}
 	}
 
@@ -142,32 +193,39 @@ static void create_vstub_long_rel(vita_elf_t *ve, vita_elf_stub_t *vstub, vita_e
 	rel->r_variable_long_entry.r_addend = *(Elf32_Word *)(&rela->addend);
 }
 
+/* Each relocation already knows its symbol, and lookup_stub_symbols() has linked
+ * every stub symbol to its stub, so a single pass over the relocation tables is
+ * enough to bucket the relocations by variable stub. Relocations are appended in
+ * table order, which keeps the per-stub ordering of the rel_info entries. */
 static int lookup_vstub_relas(vita_elf_t *ve)
 {
 	vita_elf_stub_t *vstub;
 	vita_elf_rela_table_t *rtable;
 	vita_elf_rela_t *rela;
+	clock_t start = clock();
 
-	for (int i = 0; i < ve->num_vstubs; i++) {
-		vstub = &(ve->vstubs[i]);
-		rtable = ve->rela_tables;
-		while (rtable != NULL) {
-			for (int j = 0; j < rtable->num_relas; j++) {
-				rela = &(rtable->relas[j]);
-				if (rela->symbol == vstub->symbol) {
-					if ((rela->addend >= -32768) && (rela->addend < 32768)) /* Addend is fully representable with 16 signed bits */
-						create_vstub_short_rel(ve, vstub, rela);
-					else
-						create_vstub_long_rel(ve, vstub, rela);
-
-					if (fixup_vstub_rela(ve, &rela->type, rela->offset) == 0)
-						FAILX("Failed to fixup vstub relocations");
-				}
-			}
-			rtable = rtable->next;
+	for (rtable = ve->rela_tables; rtable != NULL; rtable = rtable->next) {
+		for (int j = 0; j < rtable->num_relas; j++) {
+			rela = &(rtable->relas[j]);
+			if (rela->symbol == NULL || rela->symbol->stub == NULL)
+				continue;
+
+			vstub = rela->symbol->stub;
+			if (vstub < ve->vstubs || vstub >= ve->vstubs + ve->num_vstubs)
+				continue; /* Function stub */
+
+			if ((rela->addend >= -32768) && (rela->addend < 32768)) /* Addend is fully representable with 16 signed bits */
+				create_vstub_short_rel(ve, vstub, rela);
+			else
+				create_vstub_long_rel(ve, vstub, rela);
+
+			if (fixup_vstub_rela(ve, &rela->type, rela->offset) == 0)
+				FAILX("Failed to fixup vstub relocations");
 		}
 	}
 
+	ve->vstub_relas_time = clock() - start;
+
 	return 1;
 
 failure:
@@ -450,11 +508,52 @@ static int load_rela_table(vita_elf_t *ve, Elf_Scn *scn)
 	return 0;
 }
 
+static int _stub_addr_sort(const void *el1, const void *el2)
+{
+	const vita_elf_stub_t *stub1 = *(vita_elf_stub_t * const *)el1;
+	const vita_elf_stub_t *stub2 = *(vita_elf_stub_t * const *)el2;
+	if (stub1->shndx > stub2->shndx)
+		return 1;
+	else if (stub1->shndx < stub2->shndx)
+		return -1;
+	if (stub1->addr > stub2->addr)
+		return 1;
+	else if (stub1->addr < stub2->addr)
+		return -1;
+	return 0;
+}
+
+#define BITMAP_TEST(bitmap, bit) ((bitmap)[(bit) / 32] & (1U << ((bit) % 32)))
+#define BITMAP_SET(bitmap, bit) ((bitmap)[(bit) / 32] |= (1U << ((bit) % 32)))
+
 static int lookup_stub_symbols(vita_elf_t *ve, int num_stubs, vita_elf_stub_t *stubs, varray *stubs_va, int sym_type)
 {
 	int symndx;
 	vita_elf_symbol_t *cursym;
-	int stub, stubs_ndx, i, *cur_ndx;
+	vita_elf_stub_t key, *keyp = &key, **found;
+	vita_elf_stub_t **sorted_stubs = NULL;
+	uint32_t *stub_scns = NULL;
+	int max_ndx = 0;
+	int i, *cur_ndx;
+
+	for (i = 0; i < stubs_va->count; i++) {
+		cur_ndx = VARRAY_ELEMENT(stubs_va, i);
+		if (*cur_ndx > max_ndx)
+			max_ndx = *cur_ndx;
+	}
+
+	/* Bitmap of the section indices holding stubs of this kind */
+	ASSERT(stub_scns = calloc(max_ndx / 32 + 1, sizeof(uint32_t)));
+	for (i = 0; i < stubs_va->count; i++) {
+		cur_ndx = VARRAY_ELEMENT(stubs_va, i);
+		BITMAP_SET(stub_scns, *cur_ndx);
+	}
+
+	/* The stubs themselves keep their load order, which the import tables depend on */
+	ASSERT(sorted_stubs = malloc((num_stubs + 1) * sizeof(vita_elf_stub_t *)));
+	for (i = 0; i < num_stubs; i++)
+		sorted_stubs[i] = &stubs[i];
+	qsort(sorted_stubs, num_stubs, sizeof(vita_elf_stub_t *), _stub_addr_sort);
 
 	for (symndx = 0; symndx < ve->num_symbols; symndx++) {
 		cursym = ve->symtab + symndx;
@@ -463,42 +562,34 @@ static int lookup_stub_symbols(vita_elf_t *ve, int num_stubs, vita_elf_stub_t *s
 			continue;
 		if (cursym->type != STT_FUNC && cursym->type != STT_OBJECT)
 			continue;
-		stubs_ndx = -1;
-		
-		for(i=0;i<stubs_va->count;i++){
-			cur_ndx = VARRAY_ELEMENT(stubs_va,i);
-			if (cursym->shndx == *cur_ndx){
-				stubs_ndx = cursym->shndx;
-				break;
-			}
-		}
-		
-		if(stubs_ndx == -1)
-			continue;	
-			
+		if (cursym->shndx < 0 || cursym->shndx > max_ndx || !BITMAP_TEST(stub_scns, cursym->shndx))
+			continue;
+
 		if (cursym->type != sym_type)
 			FAILX("Global symbol %s in section %d expected to have type %s; instead has type %s",
-					cursym->name, stubs_ndx, elf_decode_st_type(sym_type), elf_decode_st_type(cursym->type));
-		
-		for (stub = 0; stub < num_stubs; stub++) {
-			if (stubs[stub].addr != cursym->value || stubs[stub].shndx != cursym->shndx)
-				continue;
-			if (stubs[stub].symbol != NULL)
-				FAILX("Stub at %06x in section %d has duplicate symbols: %s, %s",
-						cursym->value, stubs_ndx, stubs[stub].symbol->name, cursym->name);
-			stubs[stub].symbol = cursym;
-			cursym->stub = &stubs[stub];
-			break;
-		}
+					cursym->name, cursym->shndx, elf_decode_st_type(sym_type), elf_decode_st_type(cursym->type));
 
-		if (stub == num_stubs)
+		key.addr = cursym->value;
+		key.shndx = cursym->shndx;
+		found = bsearch(&keyp, sorted_stubs, num_stubs, sizeof(vita_elf_stub_t *), _stub_addr_sort);
+		if (found == NULL)
 			FAILX("Global symbol %s in section %d not pointing to a valid stub",
 					cursym->name, cursym->shndx);
+
+		if ((*found)->symbol != NULL)
+			FAILX("Stub at %06x in section %d has duplicate symbols: %s, %s",
+					cursym->value, cursym->shndx, (*found)->symbol->name, cursym->name);
+		(*found)->symbol = cursym;
+		cursym->stub = *found;
 	}
 
+	free(sorted_stubs);
+	free(stub_scns);
 	return 1;
 
 failure:
+	free(sorted_stubs);
+	free(stub_scns);
 	return 0;
 }
 
@@ -540,6 +631,89 @@ failure:
 	return 0;
 }
 
+/* Map the whole input copy-on-write so that libelf parses it in place
+ * instead of reading its own copy.  Returns 0 if the file can't be mapped, in which
+ * case the caller falls back to ELF_C_READ. */
+static int map_input_image(vita_elf_t *ve)
+{
+#ifdef HAVE_FILE_MMAP
+	struct stat st;
+	void *image;
+
+	if (fstat(fileno(ve->file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return 0;
+
+	image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(ve->file), 0);
+	if (image == MAP_FAILED)
+		return 0;
+
+	ve->image = image;
+	ve->image_size = st.st_size;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Set up the host view of a PT_LOAD segment.  When the input is mapped, the file-backed
+ * part of the segment is a private file mapping, so it shares the page cache with the
+ * input and only the pages that are touched get faulted in; the rest is anonymous zero
+ * fill.  Otherwise the segment is read into an anonymous mapping. */
+static int load_segment(vita_elf_t *ve, const GElf_Phdr *phdr, vita_elf_segment_info_t *seg)
+{
+#ifdef HAVE_FILE_MMAP
+	if (ve->image != NULL) {
+		size_t page_size = sysconf(_SC_PAGESIZE);
+		size_t delta = phdr->p_offset % page_size;
+		size_t file_end = delta + phdr->p_filesz;
+		size_t file_page_end = (file_end + page_size - 1) & ~(page_size - 1);
+		void *base;
+
+		if (phdr->p_filesz > phdr->p_memsz || phdr->p_offset + phdr->p_filesz > ve->image_size)
+			FAILX("Segment at offset 0x%x does not fit in the input file", (uint32_t)phdr->p_offset);
+
+		seg->map_size = delta + seg->memsz;
+		if (seg->map_size < file_page_end)
+			seg->map_size = file_page_end;
+
+		base = mmap(NULL, seg->map_size, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (base == MAP_FAILED)
+			FAIL("Could not allocate address space for segment");
+		seg->map_base = base;
+
+		if (phdr->p_filesz != 0) {
+			if (mmap(base, file_end, PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_FIXED, fileno(ve->file), phdr->p_offset - delta) == MAP_FAILED)
+				FAIL("Could not map segment");
+			/* The last file page may carry bytes that follow the segment in the file */
+			if (seg->map_size > file_end)
+				memset(base + file_end, 0, file_page_end - file_end);
+		}
+
+		seg->vaddr_top = base + delta;
+		seg->vaddr_bottom = seg->vaddr_top + seg->memsz;
+		return 1;
+	}
+#endif
+
+	seg->map_base = mmap(NULL, seg->memsz, /* PROT_NONE */ PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (seg->map_base == NULL)
+		FAIL("Could not allocate address space for segment");
+	seg->map_size = seg->memsz;
+	seg->vaddr_top = seg->map_base;
+	seg->vaddr_bottom = seg->vaddr_top + seg->memsz;
+
+	memset(seg->map_base, 0, seg->memsz);
+	if (phdr->p_filesz != 0) {
+		fseek(ve->file, phdr->p_offset, SEEK_SET);
+		if (fread(seg->map_base, phdr->p_filesz, 1, ve->file) != 1)
+			FAIL("Could not read segment");
+	}
+
+	return 1;
+failure:
+	return 0;
+}
+
 vita_elf_t *vita_elf_load(const char *filename, int check_stub_count, vita_export_t *export)
 {
 	vita_elf_t *ve = NULL;
@@ -563,11 +737,20 @@ vita_elf_t *vita_elf_load(const char *filename, int check_stub_count, vita_expor
 	
 	ASSERT(varray_init(&ve->fstubs_va, sizeof(int), 8));
 	ASSERT(varray_init(&ve->vstubs_va, sizeof(int), 4));
+	ASSERT(varray_init(&ve->scn_ranges, sizeof(vita_elf_scn_range_t), 32));
+	ve->scn_ranges.sort_compar = _scn_range_sort;
+	ve->scn_ranges.search_compar = _scn_range_search;
+	ASSERT(varray_init(&ve->seg_ranges, sizeof(vita_elf_segment_info_t *), 4));
+	ve->seg_ranges.sort_compar = _seg_range_sort;
+	ve->seg_ranges.search_compar = _seg_range_search;
 
 	if ((ve->file = fopen(filename, "rb")) == NULL)
 		FAIL("open %s failed", filename);
 
-	ELF_ASSERT(ve->elf = elf_begin(fileno(ve->file), ELF_C_READ, NULL));
+	if (map_input_image(ve))
+		ELF_ASSERT(ve->elf = elf_memory(ve->image, ve->image_size));
+	else
+		ELF_ASSERT(ve->elf = elf_begin(fileno(ve->file), ELF_C_READ, NULL));
 
 	if (elf_kind(ve->elf) != ELF_K_ELF)
 		FAILX("%s is not an ELF file", filename);
@@ -589,6 +772,11 @@ vita_elf_t *vita_elf_load(const char *filename, int check_stub_count, vita_expor
 
 		ELF_ASSERT(name = elf_strptr(ve->elf, shstrndx, shdr.sh_name));
 
+		if ((shdr.sh_flags & SHF_ALLOC) && shdr.sh_type != SHT_NOBITS && shdr.sh_size != 0) {
+			vita_elf_scn_range_t range = { shdr.sh_addr, shdr.sh_size, scn };
+			ASSERT(varray_push(&ve->scn_ranges, &range));
+		}
+
 		if (shdr.sh_type == SHT_PROGBITS && strncmp(name, ".vitalink.fstubs", strlen(".vitalink.fstubs")) == 0) {
 			int ndxscn = elf_ndxscn(scn);
 			varray_push(&ve->fstubs_va,&ndxscn);
@@ -658,25 +846,29 @@ vita_elf_t *vita_elf_load(const char *filename, int check_stub_count, vita_expor
 		curseg->vaddr = phdr.p_vaddr;
 		curseg->memsz = phdr.p_memsz;
 
+		/* Count it first so that vita_elf_free() releases a partially set up segment */
+		loaded_segments++;
+		ve->num_segments = loaded_segments;
+
 		if (curseg->memsz) {
-			curseg->vaddr_top = mmap(NULL, curseg->memsz, /* PROT_NONE */ PROT_WRITE | PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
-			if (curseg->vaddr_top == NULL)
-				FAIL("Could not allocate address space for segment %d", (int)segndx);
-			curseg->vaddr_bottom = curseg->vaddr_top + curseg->memsz;
-
-			memset(curseg->vaddr_top, 0, curseg->memsz);
-			if (phdr.p_filesz != 0) {
-				fseek(ve->file, phdr.p_offset, SEEK_SET);
-				if (fread((void *)(curseg->vaddr_top), phdr.p_filesz, 1, ve->file) != 1) {
-					FAIL("Could not read segment %d", (int)segndx);
-				}
-			}
+			if (!load_segment(ve, &phdr, curseg))
+				FAILX("Could not load segment %d", (int)segndx);
 		}
-		
-		loaded_segments++;
 	}
 	ve->num_segments = loaded_segments;
 
+	for (segndx = 0; segndx < ve->num_segments; segndx++) {
+		curseg = ve->segments + segndx;
+		/* Segments of type EXIDX will duplicate '.ARM.extab .ARM.exidx' sections already present in the data segment
+		 * Since these won't be loaded, we should prefer the actual data segment */
+		if (curseg->type == SHT_ARM_EXIDX)
+			continue;
+		ASSERT(varray_push(&ve->seg_ranges, &curseg));
+	}
+
+	varray_sort(&ve->scn_ranges);
+	varray_sort(&ve->seg_ranges);
+
 	/* This part can only be done after the segments have been loaded */
 	if (lookup_vstub_relas(ve) == 0)
 		FAILX("Failed to lookup the vstub relocations");
@@ -702,19 +894,29 @@ void vita_elf_free(vita_elf_t *ve)
 	int i;
 
 	for (i = 0; i < ve->num_segments; i++) {
-		if (ve->segments[i].vaddr_top != NULL)
-			munmap((void *)ve->segments[i].vaddr_top, ve->segments[i].memsz);
+		if (ve->segments[i].map_base != NULL)
+			munmap(ve->segments[i].map_base, ve->segments[i].map_size);
 	}
 
 	for (i = 0; i < ve->num_vstubs; i++)
 		free(ve->vstubs[i].rel_info);
 
+	varray_destroy(&ve->scn_ranges);
+	varray_destroy(&ve->seg_ranges);
+
+	free(ve->symhash_buckets);
+	free(ve->symhash_chain);
+
 	/* free() is safe to call on NULL */
 	free(ve->fstubs);
 	free(ve->vstubs);
 	free(ve->symtab);
 	if (ve->elf != NULL)
 		elf_end(ve->elf);
+#ifdef HAVE_FILE_MMAP
+	if (ve->image != NULL)
+		munmap(ve->image, ve->image_size);
+#endif
 	if (ve->file != NULL)
 		fclose(ve->file);
 	free(ve);
@@ -733,18 +935,104 @@ static int compar_export_symbols(const void * a, const void *b)
 	return 0;
 }
 
-static int vita_elf_has_global_func(vita_elf_t *ve, const char *name)
+/* FNV-1a */
+static uint32_t symbol_name_hash(const char *name)
+{
+	uint32_t hash = 0x811C9DC5;
+
+	while (*name != '\0')
+		hash = (hash ^ (uint8_t)*name++) * 0x01000193;
+
+	return hash;
+}
+
+static int build_symbol_hash(vita_elf_t *ve)
+{
+	int i, bucket;
+
+	ve->symhash_nbucket = ve->num_symbols / 2 + 1;
+	ve->symhash_buckets = malloc(ve->symhash_nbucket * sizeof(int));
+	ve->symhash_chain = malloc((ve->num_symbols + 1) * sizeof(int));
+	if (ve->symhash_buckets == NULL || ve->symhash_chain == NULL) {
+		free(ve->symhash_buckets);
+		free(ve->symhash_chain);
+		ve->symhash_buckets = NULL;
+		ve->symhash_chain = NULL;
+		return 0;
+	}
+
+	for (i = 0; i < ve->symhash_nbucket; i++)
+		ve->symhash_buckets[i] = -1;
+
+	/* Insert backwards so every chain ends up in ascending symtab order */
+	for (i = ve->num_symbols - 1; i >= 0; i--) {
+		ve->symhash_chain[i] = -1;
+		if (ve->symtab[i].name == NULL)
+			continue;
+		bucket = symbol_name_hash(ve->symtab[i].name) % ve->symhash_nbucket;
+		ve->symhash_chain[i] = ve->symhash_buckets[bucket];
+		ve->symhash_buckets[bucket] = i;
+	}
+
+	return 1;
+}
+
+const vita_elf_symbol_t *vita_elf_find_symbol(const vita_elf_t *ve, const char *name, int type, const vita_elf_symbol_t *prev)
 {
+	const vita_elf_symbol_t *sym;
 	int i;
-	for (i = 0; i < ve->num_symbols; i++) {
-		vita_elf_symbol_t *s = &ve->symtab[i];
-		if (s->stub == NULL && s->binding == STB_GLOBAL && s->type == STT_FUNC
-				&& strcmp(s->name, name) == 0)
+
+	/* The hash is a lookup cache only, so build it even through a const pointer */
+	if (ve->symhash_buckets == NULL && !build_symbol_hash((vita_elf_t *)ve))
+		return NULL;
+
+	if (prev == NULL)
+		i = ve->symhash_buckets[symbol_name_hash(name) % ve->symhash_nbucket];
+	else
+		i = ve->symhash_chain[prev - ve->symtab];
+
+	for (; i >= 0; i = ve->symhash_chain[i]) {
+		sym = &ve->symtab[i];
+		if (sym->type == type && strcmp(sym->name, name) == 0)
+			return sym;
+	}
+
+	return NULL;
+}
+
+static int vita_elf_has_global_func(vita_elf_t *ve, const char *name)
+{
+	const vita_elf_symbol_t *s;
+
+	for (s = vita_elf_find_symbol(ve, name, STT_FUNC, NULL); s != NULL; s = vita_elf_find_symbol(ve, name, STT_FUNC, s)) {
+		if (s->stub == NULL && s->binding == STB_GLOBAL)
 			return 1;
 	}
 	return 0;
 }
 
+#define EXPORT_HASH_CHUNK 64
+
+/* NIDs of the symbols from their names, a chunk at a time through the NID cache */
+static void hash_export_symbols(vita_export_symbol **symbols, size_t count)
+{
+	const uint8_t *names[EXPORT_HASH_CHUNK];
+	size_t lens[EXPORT_HASH_CHUNK];
+	uint32_t nids[EXPORT_HASH_CHUNK];
+	size_t i, j, n;
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < EXPORT_HASH_CHUNK ? count - i : EXPORT_HASH_CHUNK;
+		for (j = 0; j < n; j++) {
+			names[j] = (const uint8_t *)symbols[i + j]->name;
+			lens[j] = strlen(symbols[i + j]->name);
+		}
+		nid_cache_32_batch_prefixed(NULL, 0, names, lens, n, nids);
+		for (j = 0; j < n; j++)
+			symbols[i + j]->nid = nids[j];
+	}
+}
+
 void vita_elf_generate_exports(vita_elf_t *ve, vita_export_t *exports)
 {
 	int i;
@@ -803,9 +1091,7 @@ void vita_elf_generate_exports(vita_elf_t *ve, vita_export_t *exports)
 
 		exportSym = malloc(sizeof(vita_export_symbol));
 
-		strLen = strlen(cursym->name);
 		exportSym->name = strdup(cursym->name);
-		exportSym->nid = sha256_32_vector(1, (uint8_t **)&exportSym->name, &strLen);
 
 		if (cursym->type == STT_FUNC) {
 			exportlib->functions = realloc(exportlib->functions, sizeof(vita_export_symbol *) * (exportlib->function_n + 1));
@@ -817,6 +1103,11 @@ void vita_elf_generate_exports(vita_elf_t *ve, vita_export_t *exports)
 		}
 	}
 
+	if (exportlib != NULL) {
+		hash_export_symbols(exportlib->functions, exportlib->function_n);
+		hash_export_symbols(exportlib->variables, exportlib->variable_n);
+	}
+
 	// Sort exports by NID
 	qsort(exportlib->variables, exportlib->variable_n, sizeof(vita_export_symbol *), compar_export_symbols);
 	qsort(exportlib->functions, exportlib->function_n, sizeof(vita_export_symbol *), compar_export_symbols);
@@ -850,13 +1141,10 @@ int vita_elf_lookup_imports(vita_elf_t *ve)
 
 const void *vita_elf_vaddr_to_host(const vita_elf_t *ve, Elf32_Addr vaddr)
 {
-	vita_elf_segment_info_t *seg;
-	int i;
+	const vita_elf_segment_info_t *seg = lookup_segment(ve, vaddr);
 
-	for (i = 0, seg = ve->segments; i < ve->num_segments; i++, seg++) {
-		if (vaddr >= seg->vaddr && vaddr < seg->vaddr + seg->memsz)
-			return seg->vaddr_top + vaddr - seg->vaddr;
-	}
+	if (seg != NULL)
+		return seg->vaddr_top + vaddr - seg->vaddr;
 
 	return NULL;
 }
@@ -914,17 +1202,10 @@ int32_t vita_elf_host_to_segoffset(const vita_elf_t *ve, const void *host_addr,
 
 int vita_elf_vaddr_to_segndx(const vita_elf_t *ve, Elf32_Addr vaddr)
 {
-	vita_elf_segment_info_t *seg;
-	int i;
+	const vita_elf_segment_info_t *seg = lookup_segment(ve, vaddr);
 
-	for (i = 0, seg = ve->segments; i < ve->num_segments; i++, seg++) {
-		/* Segments of type EXIDX will duplicate '.ARM.extab .ARM.exidx' sections already present in the data segment
-		 * Since these won't be loaded, we should prefer the actual data segment */
-		if (seg->type == SHT_ARM_EXIDX)
-			continue;
-		if (vaddr >= seg->vaddr && vaddr < seg->vaddr + seg->memsz)
-			return i;
-	}
+	if (seg != NULL)
+		return seg - ve->segments;
 
 	return -1;
 }
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <libelf.h>
 #include <stdint.h>
+#include <time.h>
 
 #include "vita-import.h"
 #include "vita-export.h"
@@ -64,13 +65,30 @@ typedef struct vita_elf_segment_info_t {
 	 * pointer targets for translated data structures. */
 	const void *vaddr_top;
 	const void *vaddr_bottom;
+
+	/* The host mapping itself; it may start before vaddr_top when the
+	 * segment is mapped straight from the input file. */
+	void *map_base;
+	size_t map_size;
 } vita_elf_segment_info_t;
 
+/* Address range of an allocated section, sorted by address in vita_elf_t.scn_ranges */
+typedef struct vita_elf_scn_range_t {
+	Elf32_Addr addr;
+	Elf32_Word size;
+	Elf_Scn *scn;
+} vita_elf_scn_range_t;
+
 typedef struct vita_elf_t {
 	FILE *file;
 	int mode;
 	Elf *elf;
 
+	/* Copy-on-write mapping of the input that libelf reads from, NULL if
+	 * the input was read with ELF_C_READ instead */
+	char *image;
+	size_t image_size;
+
 	uint32_t module_sdk_version;
 	Elf32_Addr module_sdk_version_ptr;
 
@@ -81,6 +99,12 @@ typedef struct vita_elf_t {
 	vita_elf_symbol_t *symtab;
 	int num_symbols;
 
+	/* Name hash over symtab, built on the first vita_elf_find_symbol() call.
+	 * Chains are in symtab order, so the first match is the lowest index. */
+	int *symhash_buckets;
+	int *symhash_chain;
+	int symhash_nbucket;
+
 	vita_elf_rela_table_t *rela_tables;
 
 	vita_elf_stub_t *fstubs;
@@ -91,10 +115,18 @@ typedef struct vita_elf_t {
 	vita_elf_segment_info_t *segments;
 	int num_segments;
 
+	/* Immutable address-sorted indexes built by vita_elf_load() for the vaddr
+	 * translation helpers.  seg_ranges holds vita_elf_segment_info_t pointers so
+	 * that later memsz extensions are seen by the lookups. */
+	varray scn_ranges;
+	varray seg_ranges;
+
 	Elf32_Addr exidx_sh_addr;
 	Elf32_Word exidx_sh_size;
 	Elf32_Addr extab_sh_addr;
 	Elf32_Word extab_sh_size;
+
+	clock_t vstub_relas_time; /* CPU time spent collecting the vstub relocations */
 } vita_elf_t;
 
 vita_elf_t *vita_elf_load(const char *filename, int check_stub_count, vita_export_t *export);
@@ -102,6 +134,9 @@ void vita_elf_free(vita_elf_t *ve);
 
 void vita_elf_generate_exports(vita_elf_t *ve, vita_export_t *exports);
 
+/* Find the next symbol named name of the given STT_* type after prev, or the first one if prev is NULL */
+const vita_elf_symbol_t *vita_elf_find_symbol(const vita_elf_t *ve, const char *name, int type, const vita_elf_symbol_t *prev);
+
 int vita_elf_lookup_imports(vita_elf_t *ve);
 
 const void *vita_elf_vaddr_to_host(const vita_elf_t *ve, Elf32_Addr vaddr);
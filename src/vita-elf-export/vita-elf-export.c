@@ -3,6 +3,7 @@
 
 #include "vita-export.h"
 #include "utils/yamlemitter.h"
+#include "utils/nid-cache.h"
 
 static void show_usage(void)
 {
@@ -10,7 +11,8 @@ static void show_usage(void)
 					"\tmod-type: valid values: 'u'/'user' for user mode, else 'k'/'kernel' for kernel mode\n"
 					"\telf: path to the elf produced by the toolchain to be used by vita-elf-create\n"
 					"\texports: path to the config yaml file specifying the module information and exports\n"
-					"\timports: path to write the import yaml generated by this tool\n");
+					"\timports: path to write the import yaml generated by this tool\n"
+					"\tset " NID_CACHE_ENV " to a file to cache symbol NIDs across runs\n");
 }
 
 char* hextostr(int x){
@@ -77,10 +79,11 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 	
-	// load our exports
+	// load our exports, through the NID cache if one is configured
+	nid_cache_open_default();
 	vita_export_t *exports = vita_exports_load(export_path, elf_path, 0);
 	
-	if (!exports)
+	if (nid_cache_close() > 0 || !exports)
 		return EXIT_FAILURE;
 	
 	yaml_emitter_t emitter;
@@ -8,6 +8,7 @@
 #include "utils/yamltree.h"
 #include "utils/yamltreeutil.h"
 #include "utils/sha256.h"
+#include "utils/nid-cache.h"
 #ifdef _WIN32
 #include <winsock2.h>
 #else
@@ -50,38 +51,104 @@ static void print_module_tree(vita_export_t *export)
 	}
 }
 
-#define EXPORT_NID_DATA_NUMBER (3)
+/* Library being parsed, with the symbols whose NID has to be derived from
+ * their name. They are hashed together whenever the library version or
+ * syscall flag changes the scheme and once the library is complete. */
+typedef struct {
+	vita_library_export *export;
+	vita_export_symbol **pending;
+	size_t pending_n;
+	size_t pending_capacity;
+} library_parse_state;
 
-int process_functions(yaml_node *entry, vita_library_export *export) {
-	if (is_scalar(entry)) {
-		yaml_scalar *key = &entry->data.scalar;
+static int defer_symbol_nid(library_parse_state *state, vita_export_symbol *symbol) {
+	if (state->pending_n == state->pending_capacity) {
+		size_t capacity = state->pending_capacity ? state->pending_capacity * 2 : 64;
+		vita_export_symbol **pending = realloc(state->pending, capacity * sizeof(vita_export_symbol *));
+		if (!pending) {
+			fprintf(stderr, "error: out of memory\n");
+			return -1;
+		}
+		state->pending = pending;
+		state->pending_capacity = capacity;
+	}
 
-		// create an export symbol for this function
-		vita_export_symbol *symbol = malloc(sizeof(vita_export_symbol));
-		symbol->name = strdup(key->value);
+	state->pending[state->pending_n++] = symbol;
+	return 0;
+}
 
-		if (export->version == 0 || export->version == 1 || export->syscall != 0) {
-			symbol->nid = sha256_32_vector(1, (uint8_t **)&key->value, (size_t *)&key->len);
-		}
-		else {
-			uint32_t ver;
-			uint8_t *data_ptr[EXPORT_NID_DATA_NUMBER];
-			size_t size_ptr[EXPORT_NID_DATA_NUMBER];
+static int hash_pending_nids(library_parse_state *state) {
+	vita_library_export *export = state->export;
+	const uint8_t **names;
+	size_t *lens, i;
+	uint32_t *nids;
 
-			ver = htonl(export->version);
+	if (state->pending_n == 0)
+		return 0;
 
-			data_ptr[0] = (uint8_t *)&ver;
-			size_ptr[0] = sizeof(ver);
+	names = malloc(state->pending_n * sizeof(*names));
+	lens = malloc(state->pending_n * sizeof(*lens));
+	nids = malloc(state->pending_n * sizeof(*nids));
+	if (!names || !lens || !nids) {
+		fprintf(stderr, "error: out of memory\n");
+		free(names);
+		free(lens);
+		free(nids);
+		return -1;
+	}
 
-			data_ptr[1] = (uint8_t *)export->name;
-			size_ptr[1] = strlen(export->name);
+	for (i = 0; i < state->pending_n; ++i) {
+		names[i] = (const uint8_t *)state->pending[i]->name;
+		lens[i] = strlen(state->pending[i]->name);
+	}
 
-			data_ptr[2] = (uint8_t *)key->value;
-			size_ptr[2] = key->len;
+	if (export->version == 0 || export->version == 1 || export->syscall != 0) {
+		nid_cache_32_batch_prefixed(NULL, 0, names, lens, state->pending_n, nids);
+	}
+	else {
+		// versioned libraries hash htonl(version) || library name || symbol name
+		size_t name_len = strlen(export->name);
+		uint8_t *prefix = malloc(sizeof(uint32_t) + name_len);
+		uint32_t ver = htonl(export->version);
 
-			symbol->nid = sha256_32_vector(EXPORT_NID_DATA_NUMBER, (uint8_t **)data_ptr, size_ptr);
+		if (!prefix) {
+			fprintf(stderr, "error: out of memory\n");
+			free(names);
+			free(lens);
+			free(nids);
+			return -1;
 		}
 
+		memcpy(prefix, &ver, sizeof(ver));
+		memcpy(prefix + sizeof(ver), export->name, name_len);
+		nid_cache_32_batch_prefixed(prefix, sizeof(ver) + name_len, names, lens, state->pending_n, nids);
+		free(prefix);
+	}
+
+	for (i = 0; i < state->pending_n; ++i)
+		state->pending[i]->nid = nids[i];
+	state->pending_n = 0;
+
+	free(names);
+	free(lens);
+	free(nids);
+	return 0;
+}
+
+int process_functions(yaml_node *entry, library_parse_state *state) {
+	vita_library_export *export = state->export;
+
+	if (is_scalar(entry)) {
+		yaml_scalar *key = &entry->data.scalar;
+
+		// create an export symbol for this function
+		vita_export_symbol *symbol = malloc(sizeof(vita_export_symbol));
+		symbol->name = strdup(key->value);
+
+		// the NID is derived from the name along with the rest of the library
+		if (defer_symbol_nid(state, symbol) < 0)
+			return -1;
+
 		// append to list
 		export->functions = realloc(export->functions, (export->function_n+1)*sizeof(const char*));
 		export->functions[export->function_n++] = symbol;
@@ -138,7 +205,9 @@ int process_functions(yaml_node *entry, vita_library_export *export) {
 	return -1;
 }
 
-int process_variables(yaml_node *entry, vita_library_export *export) {
+int process_variables(yaml_node *entry, library_parse_state *state) {
+	vita_library_export *export = state->export;
+
 	if (is_scalar(entry)) {
 		yaml_scalar *key = &entry->data.scalar;
 
@@ -146,27 +215,9 @@ int process_variables(yaml_node *entry, vita_library_export *export) {
 		vita_export_symbol *symbol = malloc(sizeof(vita_export_symbol));
 		symbol->name = strdup(key->value);
 
-		if (export->version == 0 || export->version == 1 || export->syscall != 0) {
-			symbol->nid = sha256_32_vector(1, (uint8_t **)&key->value, (size_t *)&key->len);
-		}
-		else {
-			uint32_t ver;
-			uint8_t *data_ptr[EXPORT_NID_DATA_NUMBER];
-			size_t size_ptr[EXPORT_NID_DATA_NUMBER];
-
-			ver = htonl(export->version);
-
-			data_ptr[0] = (uint8_t *)&ver;
-			size_ptr[0] = sizeof(ver);
-
-			data_ptr[1] = (uint8_t *)export->name;
-			size_ptr[1] = strlen(export->name);
-
-			data_ptr[2] = (uint8_t *)key->value;
-			size_ptr[2] = key->len;
-
-			symbol->nid = sha256_32_vector(EXPORT_NID_DATA_NUMBER, (uint8_t **)data_ptr, size_ptr);
-		}
+		// the NID is derived from the name along with the rest of the library
+		if (defer_symbol_nid(state, symbol) < 0)
+			return -1;
 
 		// append to list
 		export->variables = realloc(export->variables, (export->variable_n+1)*sizeof(const char*));
@@ -282,7 +333,9 @@ int process_module_version(yaml_node *parent, yaml_node *child, vita_export_t *i
 	return 0;
 }
 
-int process_export(yaml_node *parent, yaml_node *child, vita_library_export *export) {
+int process_export(yaml_node *parent, yaml_node *child, library_parse_state *state) {
+	vita_library_export *export = state->export;
+
 	if (!is_scalar(parent)) {
 		fprintf(stderr, "error: line: %zd, column: %zd, expecting library key to be scalar, got '%s'.\n", parent->position.line, parent->position.column, node_type_str(parent));
 		return -1;
@@ -296,17 +349,20 @@ int process_export(yaml_node *parent, yaml_node *child, vita_library_export *exp
 			return -1;
 		}
 		
+		if (hash_pending_nids(state) < 0)
+			return -1;
+
 		if (process_boolean(child, &export->syscall) < 0) {
 			fprintf(stderr, "error: line: %zd, column: %zd, could not convert export library flag to boolean, got '%s'. expected 'true' or 'false'.\n", child->position.line, child->position.column, child->data.scalar.value);
 			return -1;
 		}
 	}
 	else if (strcmp(key->value, "functions") == 0) {
-		if (yaml_iterate_sequence(child, (sequence_functor)process_functions, export) < 0)
+		if (yaml_iterate_sequence(child, (sequence_functor)process_functions, state) < 0)
 			return -1;
 	}
 	else if (strcmp(key->value, "variables") == 0) {
-		if (yaml_iterate_sequence(child, (sequence_functor)process_variables, export) < 0)
+		if (yaml_iterate_sequence(child, (sequence_functor)process_variables, state) < 0)
 			return -1;
 	}
 	else if (strcmp(key->value, "nid") == 0) {
@@ -326,6 +382,9 @@ int process_export(yaml_node *parent, yaml_node *child, vita_library_export *exp
 			return -1;
 		}
 		
+		if (hash_pending_nids(state) < 0)
+			return -1;
+
 		if (process_32bit_integer(child, &export->version) < 0) {
 			fprintf(stderr, "error: line: %zd, column: %zd, could not convert library version '%s' to 32 bit integer.\n", child->position.line, child->position.column, child->data.scalar.value);
 			return -1;
@@ -366,6 +425,8 @@ int process_export_list(yaml_node *parent, yaml_node *child, vita_export_t *info
 	
 	yaml_scalar *key = &parent->data.scalar;
 	vita_library_export *export = malloc(sizeof(vita_library_export));
+	library_parse_state state = { export, NULL, 0, 0 };
+	int ret;
 	memset(export, 0, sizeof(vita_library_export));
 	
 	// default values
@@ -374,7 +435,11 @@ int process_export_list(yaml_node *parent, yaml_node *child, vita_export_t *info
 	export->syscall = 0;
 	export->version = 1;
 	
-	if (yaml_iterate_mapping(child, (mapping_functor)process_export, export) < 0)
+	ret = yaml_iterate_mapping(child, (mapping_functor)process_export, &state);
+	if (ret == 0)
+		ret = hash_pending_nids(&state);
+	free(state.pending);
+	if (ret < 0)
 		return -1;
 	
 	info->libs = realloc(info->libs, (info->lib_n+1)*sizeof(vita_library_export*));
@@ -4,8 +4,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include "vita-nid-db-yml.h"
 #include "vita-nid-db.h"
+#include "vita-stub-archive.h"
 #include "defs.h"
 #include "utils/fs_list.h"
 
@@ -128,8 +130,7 @@ int library_name(const char *name, void *argp){
 
 int library_stubname(const char *name, void *argp){
 	DBContext *ctx = (DBContext *)argp;
-	free(ctx->pLibrary->stubname);
-	ctx->pLibrary->stubname = strdup(name);
+	db_set_library_stubname(ctx->pLibrary, name);
 	return 0;
 }
 
@@ -163,7 +164,7 @@ int entry_function(const char *name, uint32_t nid, void *argp){
 	DBEntry *entry;
 
 	db_new_entry_function(ctx->pLibrary, name, &entry);
-	entry->nid = nid;
+	db_set_entry_nid(entry, nid);
 
 	return 0;
 }
@@ -174,7 +175,7 @@ int entry_variable(const char *name, uint32_t nid, void *argp){
 	DBEntry *entry;
 
 	db_new_entry_variable(ctx->pLibrary, name, &entry);
-	entry->nid = nid;
+	db_set_entry_nid(entry, nid);
 
 	return 0;
 }
@@ -216,6 +217,10 @@ int library_callback(DBLibrary *library, void *argp){
 		_vita_nid_db_search_or_create_stub_by_name(ctx, library->module->name, &stub);
 	}
 
+	if(stub == NULL){
+		return -1;
+	}
+
 	_vita_nid_db_stub_push_library(stub, library);
 
 	return 0;
@@ -251,7 +256,105 @@ const char *find_item(int argc, char *argv[], const char *name){
 	return NULL;
 }
 
-void vita_nid_db_gen_asm(NidStub *stub, DBEntry *entry, int is_function){
+/* First word of a stub record: library version and flags */
+uint32_t vita_nid_db_stub_attr(DBLibrary *library, int is_weak){
+
+	int flag = 0;
+
+	if(library->privilege == LIBRARY_LOCATE_KERNEL){
+		flag |= VITA_STUB_GEN_2_FLAG_IS_KERNEL;
+	}
+
+	if(is_weak != 0){
+		flag |= VITA_STUB_GEN_2_FLAG_WEAK;
+	}
+
+	return ((library->version & 0xFFFF) << 16) | (flag & 0xFFFF);
+}
+
+int file_exists(const char *path){
+	struct stat stat_buf;
+	return stat(path, &stat_buf) == 0;
+}
+
+int files_equal(const char *path_a, const char *path_b){
+
+	char buf_a[0x1000], buf_b[0x1000];
+	int res = 0;
+
+	FILE *fp_a = fopen(path_a, "rb");
+	FILE *fp_b = fopen(path_b, "rb");
+
+	if(fp_a != NULL && fp_b != NULL){
+		while(1){
+			size_t size_a = fread(buf_a, 1, sizeof(buf_a), fp_a);
+			size_t size_b = fread(buf_b, 1, sizeof(buf_b), fp_b);
+			if(size_a != size_b || memcmp(buf_a, buf_b, size_a) != 0){
+				break;
+			}
+			if(size_a == 0){
+				res = 1;
+				break;
+			}
+		}
+	}
+
+	if(fp_a != NULL){
+		fclose(fp_a);
+	}
+	if(fp_b != NULL){
+		fclose(fp_b);
+	}
+
+	return res;
+}
+
+/*
+ * Build files go to path.tmp first and only replace path when their
+ * contents differ, so a rerun leaves unchanged ones with their mtime
+ */
+FILE *output_open(const char *path){
+
+	char tmp_path[0x400];
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	FILE *fp = fopen(tmp_path, "wb");
+	if(fp == NULL){
+		printf("error: cannot create %s\n", tmp_path);
+	}
+
+	return fp;
+}
+
+int output_close(FILE *fp, const char *path){
+
+	char tmp_path[0x400];
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	int res = ferror(fp);
+	if(fclose(fp) != 0 || res != 0){
+		printf("error: cannot write %s\n", tmp_path);
+		remove(tmp_path);
+		return -1;
+	}
+
+	if(files_equal(tmp_path, path)){
+		remove(tmp_path);
+		return 0;
+	}
+
+	remove(path);
+	if(rename(tmp_path, path) != 0){
+		printf("error: cannot rename %s to %s\n", tmp_path, path);
+		return -1;
+	}
+
+	return 0;
+}
+
+int vita_nid_db_gen_asm(NidStub *stub, DBEntry *entry, int is_function, int rewrite){
 
 	char path[0x400];
 
@@ -262,7 +365,16 @@ void vita_nid_db_gen_asm(NidStub *stub, DBEntry *entry, int is_function){
 	// snprintf(path, sizeof(path), "%s/%s/%s.S", stub->name, entry->library->name, entry->name);
 	snprintf(path, sizeof(path), "%s_%s_%s.S", stub->name, entry->library->name, entry->name);
 
+	// The library is unchanged since the last run
+	if(rewrite == 0 && file_exists(path)){
+		return 0;
+	}
+
 	FILE *fp = fopen(path, "wb");
+	if(fp == NULL){
+		printf("error: cannot create %s\n", path);
+		return -1;
+	}
 
 	fprintf(fp, ".arch armv7a\n\n");
 
@@ -281,23 +393,374 @@ void vita_nid_db_gen_asm(NidStub *stub, DBEntry *entry, int is_function){
 		fprintf(fp, ".type %s, %%object\n", entry->name);
 	}
 
-	int flag = 0;
-
-	if(entry->library->privilege == LIBRARY_LOCATE_KERNEL){
-		flag |= VITA_STUB_GEN_2_FLAG_IS_KERNEL;
-	}
-
 	fprintf(fp, "%s:\n", entry->name);
 	fprintf(fp, ".if GEN_WEAK_EXPORTS\n");
-	fprintf(fp, "\t.word 0x%04X%04X\n", entry->library->version & 0xFFFF, (flag | VITA_STUB_GEN_2_FLAG_WEAK) & 0xFFFF);
+	fprintf(fp, "\t.word 0x%08X\n", vita_nid_db_stub_attr(entry->library, 1));
 	fprintf(fp, ".else\n");
-	fprintf(fp, "\t.word 0x%04X%04X\n", entry->library->version & 0xFFFF, flag & 0xFFFF);
+	fprintf(fp, "\t.word 0x%08X\n", vita_nid_db_stub_attr(entry->library, 0));
 	fprintf(fp, ".endif //GEN_WEAK_EXPORTS\n");
 	fprintf(fp, "\t.word 0x%08X\n", entry->library->nid);
 	fprintf(fp, "\t.word 0x%08X\n", entry->nid);
 	fprintf(fp, "\t.align 4\n");
 
 	fclose(fp);
+
+	return 0;
+}
+
+int asm_function_callback(DBEntry *entry, void *argp){
+	_VitaNIDLibStub *libstub = (_VitaNIDLibStub *)argp;
+	return vita_nid_db_gen_asm(libstub->nid_stub, entry, 1, libstub->changed);
+}
+
+int asm_variable_callback(DBEntry *entry, void *argp){
+	_VitaNIDLibStub *libstub = (_VitaNIDLibStub *)argp;
+	return vita_nid_db_gen_asm(libstub->nid_stub, entry, 0, libstub->changed);
+}
+
+int asm_libstub_callback(_VitaNIDLibStub *libstub, void *argp){
+
+	if(db_execute_function_vector(libstub->library, asm_function_callback, libstub) < 0){
+		return -1;
+	}
+
+	return db_execute_variable_vector(libstub->library, asm_variable_callback, libstub);
+}
+
+int asm_stub_callback(NidStub *nid_stub, void *argp){
+	return libstub_execute_vector(nid_stub, asm_libstub_callback, NULL);
+}
+
+typedef struct StubJobs {
+	NidStub **stubs;
+	int count;
+	int next;
+	int res;
+	int (* callback)(NidStub *nid_stub, void *argp);
+	pthread_mutex_t lock;
+} StubJobs;
+
+int stub_jobs_push_callback(NidStub *nid_stub, void *argp){
+	StubJobs *jobs = (StubJobs *)argp;
+
+	if(jobs->stubs != NULL){
+		jobs->stubs[jobs->count] = nid_stub;
+	}
+	jobs->count++;
+
+	return 0;
+}
+
+void *stub_jobs_worker(void *argp){
+
+	StubJobs *jobs = (StubJobs *)argp;
+
+	while(1){
+		pthread_mutex_lock(&jobs->lock);
+		int i = jobs->next++;
+		pthread_mutex_unlock(&jobs->lock);
+
+		if(i >= jobs->count){
+			break;
+		}
+
+		if(jobs->callback(jobs->stubs[i], NULL) < 0){
+			pthread_mutex_lock(&jobs->lock);
+			jobs->res = -1;
+			jobs->next = jobs->count; // don't start any more stubs
+			pthread_mutex_unlock(&jobs->lock);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Runs callback for every stub on stub_ctx->jobs threads. Every stub writes
+ * its own files, so the output doesn't depend on which thread gets which;
+ * build files are still written serially in list order.
+ */
+int stub_execute_parallel(StubContext *stub_ctx, int (* callback)(NidStub *nid_stub, void *argp)){
+
+	StubJobs jobs;
+	pthread_t *threads;
+	int started = 0;
+
+	if(stub_ctx->jobs <= 1){
+		return stub_execute_vector(stub_ctx, callback, NULL);
+	}
+
+	memset(&jobs, 0, sizeof(jobs));
+	jobs.callback = callback;
+
+	stub_execute_vector(stub_ctx, stub_jobs_push_callback, &jobs);
+	jobs.stubs = (NidStub **)malloc(sizeof(NidStub *) * (jobs.count + 1));
+	if(jobs.stubs == NULL){
+		return -1;
+	}
+	jobs.count = 0;
+	stub_execute_vector(stub_ctx, stub_jobs_push_callback, &jobs);
+
+	pthread_mutex_init(&jobs.lock, NULL);
+
+	// The calling thread is one of the workers
+	int num_threads = stub_ctx->jobs < jobs.count ? stub_ctx->jobs : jobs.count;
+	threads = (pthread_t *)calloc(num_threads > 1 ? num_threads - 1 : 1, sizeof(pthread_t));
+	for(; threads != NULL && started < num_threads - 1; started++){
+		if(pthread_create(&threads[started], NULL, stub_jobs_worker, &jobs) != 0){
+			break;
+		}
+	}
+
+	stub_jobs_worker(&jobs);
+
+	while(started > 0){
+		pthread_join(threads[--started], NULL);
+	}
+
+	free(threads);
+	free(jobs.stubs);
+	pthread_mutex_destroy(&jobs.lock);
+
+	return jobs.res;
+}
+
+#define STUB_MANIFEST_PATH ".vita-libs-gen-2.manifest"
+
+// Bump when the generated files change for the same database
+#define STUB_MANIFEST_FORMAT "vita-libs-gen-2 1"
+
+/*
+ * Content hash of every library from the previous run, keyed by stub and
+ * library name. Stubs whose libraries all hash the same keep their files.
+ */
+typedef struct ManifestEntry {
+	char *stub;
+	char *library;
+	uint64_t hash;
+} ManifestEntry;
+
+typedef struct StubManifest {
+	ManifestEntry *entries;
+	int count;
+	uint64_t seed;
+} StubManifest;
+
+uint64_t hash_bytes(uint64_t hash, const void *data, size_t size){
+
+	const unsigned char *p = (const unsigned char *)data;
+
+	// FNV-1a
+	for(size_t i=0;i<size;i++){
+		hash ^= p[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+uint64_t hash_string(uint64_t hash, const char *s){
+	return hash_bytes(hash, s, strlen(s) + 1);
+}
+
+uint64_t hash_word(uint64_t hash, uint32_t v){
+
+	unsigned char b[4];
+
+	b[0] = v;
+	b[1] = v >> 8;
+	b[2] = v >> 16;
+	b[3] = v >> 24;
+
+	return hash_bytes(hash, b, sizeof(b));
+}
+
+int hash_function_callback(DBEntry *entry, void *argp){
+	uint64_t *hash = (uint64_t *)argp;
+	*hash = hash_word(hash_string(hash_word(*hash, 1), entry->name), entry->nid);
+	return 0;
+}
+
+int hash_variable_callback(DBEntry *entry, void *argp){
+	uint64_t *hash = (uint64_t *)argp;
+	*hash = hash_word(hash_string(hash_word(*hash, 0), entry->name), entry->nid);
+	return 0;
+}
+
+uint64_t hash_library(DBLibrary *library, uint64_t seed){
+
+	uint64_t hash = hash_string(seed, library->name);
+
+	hash = hash_word(hash, library->nid);
+	hash = hash_word(hash, library->version);
+	hash = hash_word(hash, library->privilege);
+
+	db_execute_function_vector(library, hash_function_callback, &hash);
+	db_execute_variable_vector(library, hash_variable_callback, &hash);
+
+	return hash;
+}
+
+int compare_manifest_entries(const void *a, const void *b){
+
+	const ManifestEntry *entry_a = (const ManifestEntry *)a;
+	const ManifestEntry *entry_b = (const ManifestEntry *)b;
+
+	int res = strcmp(entry_a->stub, entry_b->stub);
+	if(res != 0){
+		return res;
+	}
+
+	return strcmp(entry_a->library, entry_b->library);
+}
+
+/* mode keeps .S and archive outputs from being taken for each other */
+void stub_manifest_load(StubManifest *manifest, const char *path, const char *mode){
+
+	char line[0x400], stub[0x180], library[0x180];
+	unsigned long long hash;
+	int capacity = 0;
+
+	manifest->entries = NULL;
+	manifest->count = 0;
+	manifest->seed = hash_string(hash_string(0xCBF29CE484222325ULL, STUB_MANIFEST_FORMAT), mode);
+
+	FILE *fp = fopen(path, "r");
+	if(fp == NULL){
+		return; // first run, everything is written
+	}
+
+	while(fgets(line, sizeof(line), fp) != NULL){
+
+		if(sscanf(line, "%383s %383s %llx", stub, library, &hash) != 3){
+			continue;
+		}
+
+		if(manifest->count == capacity){
+			capacity = (capacity == 0) ? 0x100 : capacity * 2;
+			ManifestEntry *entries = (ManifestEntry *)realloc(manifest->entries, sizeof(*entries) * capacity);
+			if(entries == NULL){
+				break;
+			}
+			manifest->entries = entries;
+		}
+
+		ManifestEntry *entry = &manifest->entries[manifest->count++];
+		entry->stub = strdup(stub);
+		entry->library = strdup(library);
+		entry->hash = hash;
+	}
+
+	fclose(fp);
+
+	if(manifest->count > 0){
+		qsort(manifest->entries, manifest->count, sizeof(ManifestEntry), compare_manifest_entries);
+	}
+}
+
+void stub_manifest_free(StubManifest *manifest){
+
+	for(int i=0;i<manifest->count;i++){
+		free(manifest->entries[i].stub);
+		free(manifest->entries[i].library);
+	}
+
+	free(manifest->entries);
+	manifest->entries = NULL;
+	manifest->count = 0;
+}
+
+int stub_manifest_count(const StubManifest *manifest, const char *stub){
+
+	int lo = 0, hi = manifest->count, count = 0;
+
+	while(lo < hi){
+		int mid = lo + (hi - lo) / 2;
+		if(strcmp(manifest->entries[mid].stub, stub) < 0){
+			lo = mid + 1;
+		}else{
+			hi = mid;
+		}
+	}
+
+	while(lo + count < manifest->count && strcmp(manifest->entries[lo + count].stub, stub) == 0){
+		count++;
+	}
+
+	return count;
+}
+
+typedef struct ManifestStubArg {
+	const StubManifest *manifest;
+	int count;
+} ManifestStubArg;
+
+int manifest_libstub_callback(_VitaNIDLibStub *libstub, void *argp){
+
+	ManifestStubArg *arg = (ManifestStubArg *)argp;
+	ManifestEntry key, *entry = NULL;
+
+	libstub->hash = hash_library(libstub->library, arg->manifest->seed);
+
+	key.stub = libstub->nid_stub->name;
+	key.library = libstub->library->name;
+	if(arg->manifest->count > 0){
+		entry = (ManifestEntry *)bsearch(&key, arg->manifest->entries, arg->manifest->count,
+			sizeof(ManifestEntry), compare_manifest_entries);
+	}
+
+	libstub->changed = (entry == NULL || entry->hash != libstub->hash);
+	if(libstub->changed != 0){
+		libstub->nid_stub->changed = 1;
+	}
+
+	arg->count++;
+
+	return 0;
+}
+
+/*
+ * Compares every library against the manifest and sets the changed flags
+ * the generators go by
+ */
+int manifest_stub_callback(NidStub *nid_stub, void *argp){
+
+	ManifestStubArg arg;
+
+	arg.manifest = (const StubManifest *)argp;
+	arg.count = 0;
+
+	nid_stub->changed = 0;
+	libstub_execute_vector(nid_stub, manifest_libstub_callback, &arg);
+
+	// A library was dropped from the stub
+	if(arg.count != stub_manifest_count(arg.manifest, nid_stub->name)){
+		nid_stub->changed = 1;
+	}
+
+	return 0;
+}
+
+int manifest_write_libstub_callback(_VitaNIDLibStub *libstub, void *argp){
+	fprintf((FILE *)argp, "%s %s %016llx\n", libstub->nid_stub->name, libstub->library->name,
+		(unsigned long long)libstub->hash);
+	return 0;
+}
+
+int manifest_write_stub_callback(NidStub *nid_stub, void *argp){
+	return libstub_execute_vector(nid_stub, manifest_write_libstub_callback, argp);
+}
+
+int stub_manifest_write(StubContext *stub_ctx, const char *path){
+
+	FILE *fp = output_open(path);
+	if(fp == NULL){
+		return -1;
+	}
+
+	stub_execute_vector(stub_ctx, manifest_write_stub_callback, fp);
+
+	return output_close(fp, path);
 }
 
 int make_target_stub_callback(NidStub *nid_stub, void *argp){
@@ -307,14 +770,12 @@ int make_target_stub_callback(NidStub *nid_stub, void *argp){
 
 int make_obj_function_callback(DBEntry *entry, void *argp){
 	_VitaNIDLibStub *libstub = (_VitaNIDLibStub *)argp;
-	vita_nid_db_gen_asm(libstub->nid_stub, entry, 1);
 	fprintf(libstub->nid_stub->context->fp, " %s_%s_%s.o", libstub->nid_stub->name, entry->library->name, entry->name);
 	return 0;
 }
 
 int make_obj_variable_callback(DBEntry *entry, void *argp){
 	_VitaNIDLibStub *libstub = (_VitaNIDLibStub *)argp;
-	vita_nid_db_gen_asm(libstub->nid_stub, entry, 0);
 	fprintf(libstub->nid_stub->context->fp, " %s_%s_%s.o", libstub->nid_stub->name, entry->library->name, entry->name);
 	return 0;
 }
@@ -364,12 +825,16 @@ int make_objs_weak_callback(NidStub *nid_stub, void *argp){
 	return 0;
 }
 
-int gen_makefile(const char *dstdir, StubContext *stub_ctx){
+int gen_makefile(StubContext *stub_ctx){
 
-	vita_nid_db_mkdir(dstdir);
-	chdir(dstdir);
+	if(stub_execute_parallel(stub_ctx, asm_stub_callback) < 0){
+		return -1;
+	}
 
-	FILE *fp = fopen("makefile", "wb");
+	FILE *fp = output_open("makefile");
+	if(fp == NULL){
+		return -1;
+	}
 	stub_ctx->fp = fp;
 
 	fprintf(fp,
@@ -416,28 +881,25 @@ int gen_makefile(const char *dstdir, StubContext *stub_ctx){
 	fprintf(fp, "\t@echo \"$?\" > $@-objs\n");
 	fprintf(fp, "\t$(AR) cru $@ @$@-objs\n");
 	fprintf(fp, "\t$(RANLIB) $@\n");
-	fprintf(fp, "\trm $^ $@-objs\n\n");
+	// The .S files and objects stay, so reruns with an unchanged database
+	// leave make nothing to rebuild
+	fprintf(fp, "\trm $@-objs\n\n");
 	fprintf(fp, "%%.o: %%.S\n");
 	fprintf(fp, "\t$(AS) --defsym GEN_WEAK_EXPORTS=0 $< -o $@\n\n");
 	fprintf(fp, "%%.wo: %%.S\n");
-	fprintf(fp, "\t$(AS) --defsym GEN_WEAK_EXPORTS=1 $< -o $@\n");
-	fprintf(fp, "\trm $^\n\n");
+	fprintf(fp, "\t$(AS) --defsym GEN_WEAK_EXPORTS=1 $< -o $@\n\n");
 
-	fclose(fp);
-
-	return 0;
+	return output_close(fp, "makefile");
 }
 
 int cmake_asm_function_callback(DBEntry *entry, void *argp){
 	_VitaNIDLibStub *libstub = (_VitaNIDLibStub *)argp;
-	vita_nid_db_gen_asm(libstub->nid_stub, entry, 1);
 	fprintf(libstub->nid_stub->context->fp, "\t%s_%s_%s.S\n", libstub->nid_stub->name, entry->library->name, entry->name);
 	return 0;
 }
 
 int cmake_asm_variable_callback(DBEntry *entry, void *argp){
 	_VitaNIDLibStub *libstub = (_VitaNIDLibStub *)argp;
-	vita_nid_db_gen_asm(libstub->nid_stub, entry, 0);
 	fprintf(libstub->nid_stub->context->fp, "\t%s_%s_%s.S\n", libstub->nid_stub->name, entry->library->name, entry->name);
 	return 0;
 }
@@ -460,12 +922,16 @@ int cmake_libstub_list_callback(NidStub *nid_stub, void *argp){
 	return 0;
 }
 
-int gen_cmake(const char *dstdir, StubContext *stub_ctx){
+int gen_cmake(StubContext *stub_ctx){
 
-	vita_nid_db_mkdir(dstdir);
-	chdir(dstdir);
+	if(stub_execute_parallel(stub_ctx, asm_stub_callback) < 0){
+		return -1;
+	}
 
-	FILE *fp = fopen("CMakeLists.txt", "wb");
+	FILE *fp = output_open("CMakeLists.txt");
+	if(fp == NULL){
+		return -1;
+	}
 	stub_ctx->fp = fp;
 
 	fprintf(fp,
@@ -497,11 +963,134 @@ int gen_cmake(const char *dstdir, StubContext *stub_ctx){
 		"endforeach(library)\n"
 	);
 
-	fclose(fp);
+	return output_close(fp, "CMakeLists.txt");
+}
+
+typedef struct ArchivePair {
+	StubArchive *strong;
+	StubArchive *weak;
+} ArchivePair;
+
+int archive_add_entry(ArchivePair *pair, NidStub *nid_stub, DBEntry *entry, int is_function){
+
+	char name[0x400];
+
+	// Same member names as the makefile's objects
+	snprintf(name, sizeof(name), "%s_%s_%s.o", nid_stub->name, entry->library->name, entry->name);
+	if(stub_archive_add(pair->strong, name, is_function, entry->library->name, entry->name,
+		vita_nid_db_stub_attr(entry->library, 0), entry->library->nid, entry->nid) < 0){
+		return -1;
+	}
+
+	snprintf(name, sizeof(name), "%s_%s_%s.wo", nid_stub->name, entry->library->name, entry->name);
+	if(stub_archive_add(pair->weak, name, is_function, entry->library->name, entry->name,
+		vita_nid_db_stub_attr(entry->library, 1), entry->library->nid, entry->nid) < 0){
+		return -1;
+	}
 
 	return 0;
 }
 
+typedef struct ArchiveLibStubArg {
+	ArchivePair *pair;
+	_VitaNIDLibStub *libstub;
+} ArchiveLibStubArg;
+
+int archive_function_callback(DBEntry *entry, void *argp){
+	ArchiveLibStubArg *arg = (ArchiveLibStubArg *)argp;
+	return archive_add_entry(arg->pair, arg->libstub->nid_stub, entry, 1);
+}
+
+int archive_variable_callback(DBEntry *entry, void *argp){
+	ArchiveLibStubArg *arg = (ArchiveLibStubArg *)argp;
+	return archive_add_entry(arg->pair, arg->libstub->nid_stub, entry, 0);
+}
+
+int archive_libstub_callback(_VitaNIDLibStub *libstub, void *argp){
+
+	ArchiveLibStubArg arg;
+
+	arg.pair = (ArchivePair *)argp;
+	arg.libstub = libstub;
+
+	if(db_execute_function_vector(libstub->library, archive_function_callback, &arg) < 0){
+		return -1;
+	}
+
+	return db_execute_variable_vector(libstub->library, archive_variable_callback, &arg);
+}
+
+int archive_stub_callback(NidStub *nid_stub, void *argp){
+
+	ArchivePair pair;
+	char path[0x400], weak_path[0x400];
+	int res = -1;
+
+	snprintf(path, sizeof(path), "lib%s_stub.a", nid_stub->name);
+	snprintf(weak_path, sizeof(weak_path), "lib%s_stub_weak.a", nid_stub->name);
+
+	// No library of the stub changed since the last run
+	if(nid_stub->changed == 0 && file_exists(path) && file_exists(weak_path)){
+		return 0;
+	}
+
+	stub_archive_new(&pair.strong);
+	stub_archive_new(&pair.weak);
+
+	if(pair.strong != NULL && pair.weak != NULL
+		&& libstub_execute_vector(nid_stub, archive_libstub_callback, &pair) >= 0){
+
+		res = stub_archive_write(pair.strong, path);
+		if(res < 0){
+			printf("error: cannot write %s\n", path);
+		}else{
+			res = stub_archive_write(pair.weak, weak_path);
+			if(res < 0){
+				printf("error: cannot write %s\n", weak_path);
+			}
+		}
+	}else{
+		printf("error: out of memory building lib%s_stub.a\n", nid_stub->name);
+	}
+
+	stub_archive_free(pair.strong);
+	stub_archive_free(pair.weak);
+
+	return res;
+}
+
+/*
+ * Writes the stub archives themselves instead of .S files and a build
+ * script, plus a makefile that only installs them
+ */
+int gen_archives(StubContext *stub_ctx){
+
+	if(stub_execute_parallel(stub_ctx, archive_stub_callback) < 0){
+		return -1;
+	}
+
+	FILE *fp = output_open("makefile");
+	if(fp == NULL){
+		return -1;
+	}
+	stub_ctx->fp = fp;
+
+	fprintf(fp, "TARGETS =");
+	stub_execute_vector(stub_ctx, make_target_stub_callback, fp);
+	fprintf(fp, "\n");
+
+	fprintf(fp, "TARGETS_WEAK =");
+	stub_execute_vector(stub_ctx, make_target_weak_stub_callback, fp);
+	fprintf(fp, "\n\n");
+
+	fprintf(fp, "all: $(TARGETS) $(TARGETS_WEAK)\n\n");
+	fprintf(fp, "install: $(TARGETS) $(TARGETS_WEAK)\n");
+	fprintf(fp, "\tcp $(TARGETS) $(VITASDK)/arm-vita-eabi/lib\n");
+	fprintf(fp, "\tcp $(TARGETS_WEAK) $(VITASDK)/arm-vita-eabi/lib\n");
+
+	return output_close(fp, "makefile");
+}
+
 extern "C" {
 	int main(int argc, char *argv[]){
 
@@ -509,6 +1098,8 @@ extern "C" {
 		const char *yml = find_item(argc, argv, "-yml=");
 		const char *output = find_item(argc, argv, "-output=");
 		const char *ignore_stubname = find_item(argc, argv, "-ignore-stubname=");
+		const char *archive = find_item(argc, argv, "-archive=");
+		const char *jobs = find_item(argc, argv, "-j=");
 
 		if(yml == NULL || output == NULL){
 			return EXIT_FAILURE;
@@ -552,28 +1143,62 @@ extern "C" {
 		}
 
 		StubContext stub_ctx;
+		memset(&stub_ctx, 0, sizeof(stub_ctx));
 		stub_ctx.Stub.next = (NidStub *)&(stub_ctx.Stub);
 		stub_ctx.Stub.prev = (NidStub *)&(stub_ctx.Stub);
 		stub_ctx.firmware = 0;
 		stub_ctx.fp = NULL;
 		stub_ctx.ignored_stubname = 0;
+		stub_ctx.jobs = 1;
 
 		if(ignore_stubname != NULL && strcmp(ignore_stubname, "true") == 0){
 			stub_ctx.ignored_stubname = 1;
 		}
 
+		if(jobs != NULL){
+			stub_ctx.jobs = strtol(jobs, NULL, 10);
+			if(stub_ctx.jobs < 1){
+				stub_ctx.jobs = 1;
+			}
+		}
+
 		db_execute_fw_vector(context, fw_callback, &stub_ctx);
 
-		if(cmake != NULL && strcmp(cmake, "true") == 0){
-			gen_cmake(output, &stub_ctx);
+		vita_nid_db_mkdir(output);
+		if(chdir(output) != 0){
+			printf("error: cannot enter %s\n", output);
+			_vita_nid_db_free_stub_context(&stub_ctx);
+			db_free_context(context);
+			return EXIT_FAILURE;
+		}
+
+		int gen_archive = (archive != NULL && strcmp(archive, "true") == 0);
+
+		// Only libraries that differ from the last run are written again
+		StubManifest manifest;
+		stub_manifest_load(&manifest, STUB_MANIFEST_PATH, gen_archive ? "archive" : "asm");
+		stub_execute_vector(&stub_ctx, manifest_stub_callback, &manifest);
+		stub_manifest_free(&manifest);
+
+		if(gen_archive != 0){
+			res = gen_archives(&stub_ctx);
+		}else if(cmake != NULL && strcmp(cmake, "true") == 0){
+			res = gen_cmake(&stub_ctx);
 		}else{
-			gen_makefile(output, &stub_ctx);
+			res = gen_makefile(&stub_ctx);
 		}
 
-		// TODO: free stub_ctx
+		if(res >= 0){
+			res = stub_manifest_write(&stub_ctx, STUB_MANIFEST_PATH);
+		}
 
+		_vita_nid_db_free_stub_context(&stub_ctx);
 		db_free_context(context);
 
+		if(res < 0){
+			return EXIT_FAILURE;
+		}
+
 		return EXIT_SUCCESS;
 	}
 }
@@ -6,6 +6,350 @@
 #include "vita-nid-db.h"
 
 
+#define DB_INDEX_FIRMWARE (1)
+#define DB_INDEX_MODULE   (2)
+#define DB_INDEX_LIBRARY  (3)
+#define DB_INDEX_FUNCTION (4)
+#define DB_INDEX_VARIABLE (5)
+#define DB_INDEX_FUNCTION_NID (6)
+#define DB_INDEX_STUB     (7)
+#define DB_INDEX_STRING   (8)
+#define DB_INDEX_VARIABLE_NID (9)
+
+#define DB_INDEX_MIN_SIZE (0x40)
+
+#define DB_ARENA_BLOCK_SIZE (0x10000)
+#define DB_ARENA_ALIGN      (8)
+
+typedef struct DBArenaBlock {
+	struct DBArenaBlock *next;
+	size_t used;
+	size_t size;
+} DBArenaBlock;
+
+static void *db_arena_alloc(DBArena *arena, size_t size, size_t align){
+
+	DBArenaBlock *block = arena->block, *new_block;
+
+	if(block != NULL){
+		uintptr_t base = (uintptr_t)(block + 1);
+		uintptr_t p = (base + block->used + align - 1) & ~(uintptr_t)(align - 1);
+		if(p + size <= base + block->size){
+			block->used = p + size - base;
+			return (void *)p;
+		}
+	}
+
+	// Large allocations get a block of their own, the current one stays in use
+	size_t block_size = (size > DB_ARENA_BLOCK_SIZE / 4) ? size + align : DB_ARENA_BLOCK_SIZE;
+
+	new_block = malloc(sizeof(*new_block) + block_size);
+	if(new_block == NULL){
+		return NULL;
+	}
+
+	new_block->size = block_size;
+	new_block->used = 0;
+
+	if(block != NULL && block_size != DB_ARENA_BLOCK_SIZE){
+		new_block->next = block->next;
+		block->next = new_block;
+	}else{
+		new_block->next = block;
+		arena->block = new_block;
+	}
+
+	uintptr_t base = (uintptr_t)(new_block + 1);
+	uintptr_t p = (base + align - 1) & ~(uintptr_t)(align - 1);
+	new_block->used = p + size - base;
+
+	return (void *)p;
+}
+
+static void db_arena_free(DBArena *arena){
+
+	DBArenaBlock *block = arena->block;
+
+	while(block != NULL){
+		DBArenaBlock *next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->block = NULL;
+}
+
+static uint32_t db_hash_bytes(uint32_t hash, const void *data, size_t size){
+
+	const unsigned char *p = data;
+
+	// FNV-1a
+	while(size-- != 0){
+		hash ^= *p++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static uint32_t db_index_hash(int kind, const void *parent, const char *name, uint32_t nid){
+
+	uint32_t hash = 0x811C9DC5;
+
+	hash = db_hash_bytes(hash, &kind, sizeof(kind));
+	hash = db_hash_bytes(hash, &parent, sizeof(parent));
+	hash = db_hash_bytes(hash, &nid, sizeof(nid));
+
+	if(name != NULL){
+		hash = db_hash_bytes(hash, name, strlen(name));
+	}
+
+	return hash;
+}
+
+static int db_index_match(const DBIndexSlot *slot, uint32_t hash, int kind, const void *parent, const char *name, uint32_t nid){
+
+	if(slot->hash != hash || slot->kind != kind || slot->parent != parent || slot->nid != nid){
+		return 0;
+	}
+
+	if(name == slot->name){
+		return 1;
+	}
+
+	if(name == NULL || slot->name == NULL){
+		return 0;
+	}
+
+	return strcmp(slot->name, name) == 0;
+}
+
+/* value NULL matches any node with the key */
+static DBIndexSlot *db_index_find(DBIndex *index, int kind, const void *parent, const char *name, uint32_t nid, const void *value){
+
+	if(index->slots == NULL){
+		return NULL;
+	}
+
+	uint32_t hash = db_index_hash(kind, parent, name, nid);
+	uint32_t i = hash & index->mask;
+
+	while(index->slots[i].value != NULL){
+		DBIndexSlot *slot = &index->slots[i];
+		if(db_index_match(slot, hash, kind, parent, name, nid) && (value == NULL || slot->value == value)){
+			return slot;
+		}
+		i = (i + 1) & index->mask;
+	}
+
+	return NULL;
+}
+
+static void *db_index_lookup(DBIndex *index, int kind, const void *parent, const char *name, uint32_t nid){
+
+	DBIndexSlot *slot = db_index_find(index, kind, parent, name, nid, NULL);
+
+	return (slot != NULL) ? slot->value : NULL;
+}
+
+static void db_index_place(DBIndexSlot *slots, uint32_t mask, const DBIndexSlot *slot){
+
+	uint32_t i = slot->hash & mask;
+
+	while(slots[i].value != NULL){
+		i = (i + 1) & mask;
+	}
+
+	slots[i] = *slot;
+}
+
+static int db_index_grow(DBIndex *index){
+
+	uint32_t size = (index->slots == NULL) ? DB_INDEX_MIN_SIZE : (index->mask + 1) * 2;
+
+	DBIndexSlot *slots = calloc(size, sizeof(*slots));
+	if(slots == NULL){
+		return -1;
+	}
+
+	if(index->slots != NULL){
+		for(uint32_t i=0;i<=index->mask;i++){
+			if(index->slots[i].value != NULL){
+				db_index_place(slots, size - 1, &index->slots[i]);
+			}
+		}
+		free(index->slots);
+	}
+
+	index->slots = slots;
+	index->mask = size - 1;
+
+	return 0;
+}
+
+/*
+ * The first node added under a key is the one found, as the list walks
+ * did. On failure the index is given up and searches walk the lists.
+ */
+static void db_index_insert(DBIndex *index, int kind, const void *parent, const char *name, uint32_t nid, void *value){
+
+	DBIndexSlot slot;
+
+	if(index->failed != 0 || db_index_find(index, kind, parent, name, nid, NULL) != NULL){
+		return;
+	}
+
+	if(index->slots == NULL || (index->count + 1) * 4 > (index->mask + 1) * 3){
+		if(db_index_grow(index) < 0){
+			free(index->slots);
+			memset(index, 0, sizeof(*index));
+			index->failed = 1;
+			return;
+		}
+	}
+
+	slot.parent = parent;
+	slot.name = name;
+	slot.value = value;
+	slot.nid = nid;
+	slot.hash = db_index_hash(kind, parent, name, nid);
+	slot.kind = kind;
+
+	db_index_place(index->slots, index->mask, &slot);
+	index->count++;
+}
+
+/* Returns 1 when value was the node indexed under the key */
+static int db_index_remove(DBIndex *index, int kind, const void *parent, const char *name, uint32_t nid, const void *value){
+
+	DBIndexSlot *slot = db_index_find(index, kind, parent, name, nid, value);
+	if(slot == NULL){
+		return 0;
+	}
+
+	uint32_t i = slot - index->slots, j = i;
+
+	index->slots[i].value = NULL;
+	index->count--;
+
+	// Shift the rest of the probe run back over the hole
+	while(1){
+		j = (j + 1) & index->mask;
+		if(index->slots[j].value == NULL){
+			break;
+		}
+
+		uint32_t home = index->slots[j].hash & index->mask;
+		if((i <= j) ? (i < home && home <= j) : (i < home || home <= j)){
+			continue;
+		}
+
+		index->slots[i] = index->slots[j];
+		index->slots[j].value = NULL;
+		i = j;
+	}
+
+	return 1;
+}
+
+static void db_index_free(DBIndex *index){
+	free(index->slots);
+	memset(index, 0, sizeof(*index));
+}
+
+static DBFirmware *db_walk_firmware(DBContext *ctx, uint32_t firmware){
+
+	DBFirmware *fw = ctx->Firmware.next;
+
+	while(fw != (DBFirmware *)&(ctx->Firmware)){
+		if(fw->firmware == firmware){
+			return fw;
+		}
+		fw = fw->next;
+	}
+
+	return NULL;
+}
+
+static DBModule *db_walk_module(DBFirmware *fw, const char *name){
+
+	DBModule *module = fw->Module.next;
+
+	while(module != (DBModule *)&(fw->Module)){
+		if(strcmp(module->name, name) == 0){
+			return module;
+		}
+		module = module->next;
+	}
+
+	return NULL;
+}
+
+static DBLibrary *db_walk_library(DBModule *module, const char *name){
+
+	DBLibrary *library = module->Library.next;
+
+	while(library != (DBLibrary *)&(module->Library)){
+		if(strcmp(library->name, name) == 0){
+			return library;
+		}
+		library = library->next;
+	}
+
+	return NULL;
+}
+
+static DBEntry *db_walk_entry(DBEntry *head, const char *name){
+
+	DBEntry *entry = head->next;
+
+	while(entry != head){
+		if(strcmp(entry->name, name) == 0){
+			return entry;
+		}
+		entry = entry->next;
+	}
+
+	return NULL;
+}
+
+static DBEntry *db_walk_entry_nid(DBEntry *head, uint32_t nid){
+
+	DBEntry *entry = head->next;
+
+	while(entry != head){
+		if(entry->nid == nid){
+			return entry;
+		}
+		entry = entry->next;
+	}
+
+	return NULL;
+}
+
+static DBIndex *db_library_index(DBLibrary *library){
+	return &library->firmware->context->index;
+}
+
+/* One copy of every name, so nodes can share it */
+static char *db_intern(DBIndex *index, DBArena *arena, const char *s){
+
+	char *str = db_index_lookup(index, DB_INDEX_STRING, NULL, s, 0);
+	if(str != NULL){
+		return str;
+	}
+
+	size_t size = strlen(s) + 1;
+
+	str = db_arena_alloc(arena, size, 1);
+	if(str != NULL){
+		memcpy(str, s, size);
+		db_index_insert(index, DB_INDEX_STRING, NULL, str, 0, str);
+	}
+
+	return str;
+}
+
 void db_new_context(DBContext **result){
 
 	DBContext *context;
@@ -17,6 +361,9 @@ void db_new_context(DBContext **result){
 		context->pFirmware = NULL;
 		context->pModule   = NULL;
 		context->pLibrary  = NULL;
+		memset(&context->index, 0, sizeof(context->index));
+		context->nodes.block = NULL;
+		context->strings.block = NULL;
 	}
 
 	*result = context;
@@ -32,7 +379,10 @@ void db_new_firmware(DBContext *context, uint32_t firmware, DBFirmware **result)
 	if(context != NULL){
 		ctx = context;
 
-		fw = malloc(sizeof(*fw));
+		fw = db_arena_alloc(&ctx->nodes, sizeof(*fw), DB_ARENA_ALIGN);
+		if(fw == NULL){
+			return;
+		}
 
 		tail = ctx->Firmware.prev;
 
@@ -41,32 +391,26 @@ void db_new_firmware(DBContext *context, uint32_t firmware, DBFirmware **result)
 		fw->firmware = firmware;
 		fw->Module.next = (DBModule *)&(fw->Module);
 		fw->Module.prev = (DBModule *)&(fw->Module);
+		fw->context = ctx;
 
 		tail->next->prev = fw;
 		tail->next = fw;
 
+		db_index_insert(&ctx->index, DB_INDEX_FIRMWARE, ctx, NULL, firmware, fw);
+
 		*result = fw;
 	}
 }
 
 void db_search_firmware(DBContext *context, uint32_t firmware, DBFirmware **result){
 
-	DBContext *ctx;
-	DBFirmware *fw, *tail;
-
 	*result = NULL;
 
 	if(context != NULL){
-		ctx = context;
-
-		fw = ctx->Firmware.next;
-		while(fw != (DBFirmware *)&(ctx->Firmware)){
-			if(fw->firmware == firmware){
-				*result = fw;
-				break;
-			}
-
-			fw = fw->next;
+		if(context->index.failed == 0){
+			*result = db_index_lookup(&context->index, DB_INDEX_FIRMWARE, context, NULL, firmware);
+		}else{
+			*result = db_walk_firmware(context, firmware);
 		}
 	}
 }
@@ -88,13 +432,19 @@ void db_new_module(DBFirmware *fw, const char *name, DBModule **result){
 	*result = NULL;
 
 	if(fw != NULL){
-		module = malloc(sizeof(*module));
+		ctx = fw->context;
+
+		module = db_arena_alloc(&ctx->nodes, sizeof(*module), DB_ARENA_ALIGN);
+		name = db_intern(&ctx->index, &ctx->strings, name);
+		if(module == NULL || name == NULL){
+			return;
+		}
 
 		tail = ((DBFirmware *)fw)->Module.prev;
 
 		module->next = tail->next;
 		module->prev = tail;
-		module->name = strdup(name);
+		module->name = (char *)name;
 		module->fingerprint = 0;
 		module->Library.next = (DBLibrary *)&(module->Library);
 		module->Library.prev = (DBLibrary *)&(module->Library);
@@ -103,25 +453,21 @@ void db_new_module(DBFirmware *fw, const char *name, DBModule **result){
 		tail->next->prev = module;
 		tail->next = module;
 
+		db_index_insert(&fw->context->index, DB_INDEX_MODULE, fw, module->name, 0, module);
+
 		*result = module;
 	}
 }
 
 void db_search_module(DBFirmware *fw, const char *name, DBModule **result){
 
-	DBModule *module;
-
 	*result = NULL;
 
 	if(fw != NULL){
-		module = ((DBFirmware *)fw)->Module.next;
-		while(module != (DBModule *)&(((DBFirmware *)fw)->Module)){
-			if(strcmp(module->name, name) == 0){
-				*result = module;
-				break;
-			}
-
-			module = module->next;
+		if(fw->context->index.failed == 0){
+			*result = db_index_lookup(&fw->context->index, DB_INDEX_MODULE, fw, name, 0);
+		}else{
+			*result = db_walk_module(fw, name);
 		}
 	}
 }
@@ -144,13 +490,19 @@ void db_new_library(DBModule *module, const char *name, DBLibrary **result){
 
 	if(module != NULL){
 
-		library = malloc(sizeof(*library));
+		DBContext *ctx = module->firmware->context;
+
+		library = db_arena_alloc(&ctx->nodes, sizeof(*library), DB_ARENA_ALIGN);
+		name = db_intern(&ctx->index, &ctx->strings, name);
+		if(library == NULL || name == NULL){
+			return;
+		}
 
 		tail = ((DBModule *)module)->Library.prev;
 
 		library->next = tail->next;
 		library->prev = tail;
-		library->name = strdup(name);
+		library->name = (char *)name;
 		library->stubname = NULL;
 		library->version = 0;
 		library->nid = 0;
@@ -165,26 +517,22 @@ void db_new_library(DBModule *module, const char *name, DBLibrary **result){
 		tail->next->prev = library;
 		tail->next = library;
 
+		db_index_insert(db_library_index(library), DB_INDEX_LIBRARY, module, library->name, 0, library);
+
 		*result = library;
 	}
 }
 
 void db_search_library(DBModule *module, const char *name, DBLibrary **result){
 
-	DBLibrary *library;
-
 	*result = NULL;
 
 	if(module != NULL){
-
-		library = ((DBModule *)module)->Library.next;
-		while(library != (DBLibrary *)&(((DBModule *)module)->Library)){
-			if(strcmp(library->name, name) == 0){
-				*result = library;
-				break;
-			}
-
-			library = library->next;
+		DBIndex *index = &module->firmware->context->index;
+		if(index->failed == 0){
+			*result = db_index_lookup(index, DB_INDEX_LIBRARY, module, name, 0);
+		}else{
+			*result = db_walk_library(module, name);
 		}
 	}
 }
@@ -198,20 +546,31 @@ void db_search_or_new_library(DBModule *module, const char *name, DBLibrary **re
 	}
 }
 
+void db_set_library_stubname(DBLibrary *library, const char *stubname){
+	DBContext *ctx = library->firmware->context;
+	library->stubname = db_intern(&ctx->index, &ctx->strings, stubname);
+}
+
 
 void db_new_entry_function(DBLibrary *library, const char *name, DBEntry **result){
 
 	DBEntry *entry;
 
+	DBContext *ctx = library->firmware->context;
+
 	*result = NULL;
 
-	entry = malloc(sizeof(*entry));
+	entry = db_arena_alloc(&ctx->nodes, sizeof(*entry), DB_ARENA_ALIGN);
+	name = db_intern(&ctx->index, &ctx->strings, name);
+	if(entry == NULL || name == NULL){
+		return;
+	}
 
 	DBEntry *tail = ((DBLibrary *)library)->Function.prev;
 
 	entry->next = tail->next;
 	entry->prev = tail;
-	entry->name = strdup(name);
+	entry->name = (char *)name;
 	entry->nid = 0;
 	entry->type = ENTRY_TYPE_FUNCTION;
 	entry->library = library;
@@ -221,24 +580,19 @@ void db_new_entry_function(DBLibrary *library, const char *name, DBEntry **resul
 	tail->next->prev = entry;
 	tail->next = entry;
 
+	db_index_insert(db_library_index(library), DB_INDEX_FUNCTION, library, entry->name, 0, entry);
+
 	*result = entry;
 }
 
 void db_search_entry_function(DBLibrary *library, const char *name, DBEntry **result){
 
-	DBEntry *entry;
-
-	*result = NULL;
-
-	entry = ((DBLibrary *)library)->Function.next;
-	while(entry != (DBEntry *)&(((DBLibrary *)library)->Function)){
+	DBIndex *index = db_library_index(library);
 
-		if(strcmp(entry->name, name) == 0){
-			*result = entry;
-			break;
-		}
-
-		entry = entry->next;
+	if(index->failed == 0){
+		*result = db_index_lookup(index, DB_INDEX_FUNCTION, library, name, 0);
+	}else{
+		*result = db_walk_entry((DBEntry *)&(library->Function), name);
 	}
 }
 
@@ -253,15 +607,21 @@ void db_new_entry_variable(DBLibrary *library, const char *name, DBEntry **resul
 
 	DBEntry *entry;
 
+	DBContext *ctx = library->firmware->context;
+
 	*result = NULL;
 
-	entry = malloc(sizeof(*entry));
+	entry = db_arena_alloc(&ctx->nodes, sizeof(*entry), DB_ARENA_ALIGN);
+	name = db_intern(&ctx->index, &ctx->strings, name);
+	if(entry == NULL || name == NULL){
+		return;
+	}
 
 	DBEntry *tail = ((DBLibrary *)library)->Variable.prev;
 
 	entry->next = tail->next;
 	entry->prev = tail;
-	entry->name = strdup(name);
+	entry->name = (char *)name;
 	entry->nid = 0;
 	entry->type = ENTRY_TYPE_VARUABLE;
 	entry->library = library;
@@ -271,24 +631,19 @@ void db_new_entry_variable(DBLibrary *library, const char *name, DBEntry **resul
 	tail->next->prev = entry;
 	tail->next = entry;
 
+	db_index_insert(db_library_index(library), DB_INDEX_VARIABLE, library, entry->name, 0, entry);
+
 	*result = entry;
 }
 
 void db_search_entry_variable(DBLibrary *library, const char *name, DBEntry **result){
 
-	DBEntry *entry;
-
-	*result = NULL;
-
-	entry = ((DBLibrary *)library)->Variable.next;
-	while(entry != (DBEntry *)&(((DBLibrary *)library)->Variable)){
-
-		if(strcmp(entry->name, name) == 0){
-			*result = entry;
-			break;
-		}
+	DBIndex *index = db_library_index(library);
 
-		entry = entry->next;
+	if(index->failed == 0){
+		*result = db_index_lookup(index, DB_INDEX_VARIABLE, library, name, 0);
+	}else{
+		*result = db_walk_entry((DBEntry *)&(library->Variable), name);
 	}
 }
 
@@ -299,6 +654,55 @@ void db_search_or_new_entry_variable(DBLibrary *library, const char *name, DBEnt
 	}
 }
 
+// Functions and variables sharing a NID are indexed apart
+static int db_nid_kind(int type){
+	return (type == ENTRY_TYPE_FUNCTION) ? DB_INDEX_FUNCTION_NID : DB_INDEX_VARIABLE_NID;
+}
+
+void db_search_entry_by_nid(DBLibrary *library, uint32_t nid, DBEntry **result){
+
+	DBIndex *index = db_library_index(library);
+
+	// Functions first, like the walk below
+	if(index->failed == 0){
+		*result = db_index_lookup(index, DB_INDEX_FUNCTION_NID, library, NULL, nid);
+		if((*result) == NULL){
+			*result = db_index_lookup(index, DB_INDEX_VARIABLE_NID, library, NULL, nid);
+		}
+	}else{
+		*result = db_walk_entry_nid((DBEntry *)&(library->Function), nid);
+		if((*result) == NULL){
+			*result = db_walk_entry_nid((DBEntry *)&(library->Variable), nid);
+		}
+	}
+}
+
+static void db_index_reinsert_nid(DBIndex *index, DBLibrary *library, int type, uint32_t nid){
+
+	// Another entry of the same type may share the NID
+	DBEntry *head = (type == ENTRY_TYPE_FUNCTION) ? (DBEntry *)&(library->Function) : (DBEntry *)&(library->Variable);
+	DBEntry *other = db_walk_entry_nid(head, nid);
+
+	if(other != NULL){
+		db_index_insert(index, db_nid_kind(type), library, NULL, nid, other);
+	}
+}
+
+void db_set_entry_nid(DBEntry *entry, uint32_t nid){
+
+	DBIndex *index = db_library_index(entry->library);
+	int kind = db_nid_kind(entry->type);
+	uint32_t old_nid = entry->nid;
+
+	entry->nid = nid;
+
+	if(db_index_remove(index, kind, entry->library, NULL, old_nid, entry) != 0){
+		db_index_reinsert_nid(index, entry->library, entry->type, old_nid);
+	}
+
+	db_index_insert(index, kind, entry->library, NULL, nid, entry);
+}
+
 
 int db_execute_fw_vector(DBContext *context, int (* callback)(DBFirmware *fw, void *argp), void *argp){
 
@@ -416,14 +820,12 @@ int db_execute_variable_vector(DBLibrary *library, int (* callback)(DBEntry *ent
 }
 
 
-static int db_free_fw_callback(DBFirmware *fw, void *argp){
-	db_free_fw(fw);
-	return 0;
-}
-
 void db_free_context(DBContext *context){
 
-	db_execute_fw_vector(context, db_free_fw_callback, NULL);
+	// Every node and string lives in the arenas
+	db_index_free(&context->index);
+	db_arena_free(&context->nodes);
+	db_arena_free(&context->strings);
 
 	free(context);
 }
@@ -435,12 +837,19 @@ static int db_free_module_callback(DBModule *module, void *argp){
 
 void db_free_fw(DBFirmware *fw){
 
+	DBContext *ctx = fw->context;
+
 	fw->next->prev = fw->prev;
 	fw->prev->next = fw->next;
 
 	db_execute_module_vector(fw, db_free_module_callback, NULL);
 
-	free(fw);
+	if(db_index_remove(&ctx->index, DB_INDEX_FIRMWARE, ctx, NULL, fw->firmware, fw) != 0){
+		DBFirmware *other = db_walk_firmware(ctx, fw->firmware);
+		if(other != NULL){
+			db_index_insert(&ctx->index, DB_INDEX_FIRMWARE, ctx, NULL, fw->firmware, other);
+		}
+	}
 }
 
 static int db_free_library_callback(DBLibrary *library, void *argp){
@@ -450,13 +859,20 @@ static int db_free_library_callback(DBLibrary *library, void *argp){
 
 void db_free_module(DBModule *module){
 
+	DBIndex *index = &module->firmware->context->index;
+
 	module->next->prev = module->prev;
 	module->prev->next = module->next;
 
 	db_execute_library_vector(module, db_free_library_callback, NULL);
 
-	free(module->name);
-	free(module);
+	if(db_index_remove(index, DB_INDEX_MODULE, module->firmware, module->name, 0, module) != 0){
+		DBModule *other = db_walk_module(module->firmware, module->name);
+		if(other != NULL){
+			db_index_insert(index, DB_INDEX_MODULE, module->firmware, other->name, 0, other);
+		}
+	}
+
 }
 
 static int db_free_entry_callback(DBEntry *entry, void *argp){
@@ -466,22 +882,43 @@ static int db_free_entry_callback(DBEntry *entry, void *argp){
 
 void db_free_library(DBLibrary *library){
 
+	DBIndex *index = db_library_index(library);
+
 	library->next->prev = library->prev;
 	library->prev->next = library->next;
 
 	db_execute_function_vector(library, db_free_entry_callback, NULL);
 	db_execute_variable_vector(library, db_free_entry_callback, NULL);
 
-	free(library->name);
-	free(library->stubname);
-	free(library);
+	if(db_index_remove(index, DB_INDEX_LIBRARY, library->module, library->name, 0, library) != 0){
+		DBLibrary *other = db_walk_library(library->module, library->name);
+		if(other != NULL){
+			db_index_insert(index, DB_INDEX_LIBRARY, library->module, other->name, 0, other);
+		}
+	}
+
 }
 
 void db_free_entry(DBEntry *entry){
+
+	DBLibrary *library = entry->library;
+	DBIndex *index = db_library_index(library);
+	int kind = (entry->type == ENTRY_TYPE_FUNCTION) ? DB_INDEX_FUNCTION : DB_INDEX_VARIABLE;
+
 	entry->next->prev = entry->prev;
 	entry->prev->next = entry->next;
-	free(entry->name);
-	free(entry);
+
+	if(db_index_remove(index, kind, library, entry->name, 0, entry) != 0){
+		DBEntry *head = (entry->type == ENTRY_TYPE_FUNCTION) ? (DBEntry *)&(library->Function) : (DBEntry *)&(library->Variable);
+		DBEntry *other = db_walk_entry(head, entry->name);
+		if(other != NULL){
+			db_index_insert(index, kind, library, other->name, 0, other);
+		}
+	}
+
+	if(db_index_remove(index, db_nid_kind(entry->type), library, NULL, entry->nid, entry) != 0){
+		db_index_reinsert_nid(index, library, entry->type, entry->nid);
+	}
 }
 
 
@@ -493,6 +930,11 @@ void _vita_nid_db_search_stub_by_name(StubContext *ctx, const char *name, NidStu
 
 	*stub = NULL;
 
+	if(ctx->index.failed == 0){
+		*stub = db_index_lookup(&ctx->index, DB_INDEX_STUB, ctx, name, ctx->firmware);
+		return;
+	}
+
 	current = ctx->Stub.next;
 
 	while(current != (NidStub *)&(ctx->Stub)){
@@ -525,15 +967,21 @@ void _vita_nid_db_search_or_create_stub_by_name(StubContext *ctx, const char *na
 	_vita_nid_db_search_stub_by_name(ctx, libname, stub);
 
 	if((*stub) == NULL){
-		current = (NidStub *)malloc(sizeof(*current));
+		current = db_arena_alloc(&ctx->arena, sizeof(*current), DB_ARENA_ALIGN);
+		char *stub_name = db_intern(&ctx->index, &ctx->arena, libname);
+		if(current == NULL || stub_name == NULL){
+			return;
+		}
+
 		current->next = NULL;
 		current->prev = NULL;
 		current->firmware = ctx->firmware;
 
-		current->name = strdup(libname);
+		current->name = stub_name;
 		current->LibStub.next = (_VitaNIDLibStub *)&(current->LibStub);
 		current->LibStub.prev = (_VitaNIDLibStub *)&(current->LibStub);
 		current->context = ctx;
+		current->changed = 1;
 
 		tail = ctx->Stub.prev;
 
@@ -543,6 +991,8 @@ void _vita_nid_db_search_or_create_stub_by_name(StubContext *ctx, const char *na
 		tail->next->prev = current;
 		tail->next = current;
 
+		db_index_insert(&ctx->index, DB_INDEX_STUB, ctx, current->name, current->firmware, current);
+
 		*stub = current;
 	}
 }
@@ -553,12 +1003,17 @@ void _vita_nid_db_stub_push_library(NidStub *stub, DBLibrary *library){
 
 	_VitaNIDLibStub *libstub;
 
-	libstub = (_VitaNIDLibStub *)malloc(sizeof(*libstub));
+	libstub = db_arena_alloc(&stub->context->arena, sizeof(*libstub), DB_ARENA_ALIGN);
+	if(libstub == NULL){
+		return;
+	}
 
 	libstub->next = tail->next;
 	libstub->prev = tail;
 	libstub->nid_stub = stub;
 	libstub->library = library;
+	libstub->hash = 0;
+	libstub->changed = 1;
 
 	tail->next->prev = libstub;
 	tail->next = libstub;
@@ -595,3 +1050,12 @@ int stub_execute_vector(StubContext *context, int (* callback)(NidStub *nid_stub
 
 	return 0;
 }
+
+void _vita_nid_db_free_stub_context(StubContext *ctx){
+
+	db_index_free(&ctx->index);
+	db_arena_free(&ctx->arena);
+
+	ctx->Stub.next = (NidStub *)&(ctx->Stub);
+	ctx->Stub.prev = (NidStub *)&(ctx->Stub);
+}
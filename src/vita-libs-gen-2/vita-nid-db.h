@@ -18,6 +18,35 @@ extern "C" {
 #define LIBRARY_LOCATE_USERMODE (1)
 #define LIBRARY_LOCATE_KERNEL   (2)
 
+/*
+ * Open addressing hash table behind the db_search_* functions, keyed by
+ * kind, parent node and name or NID. The lists stay the only owners and
+ * keep the iteration order.
+ */
+typedef struct DBIndexSlot {
+	const void *parent;
+	const char *name;
+	void *value;
+	uint32_t nid;
+	uint32_t hash;
+	int kind;
+} DBIndexSlot;
+
+typedef struct DBIndex {
+	DBIndexSlot *slots;
+	uint32_t mask;
+	uint32_t count;
+	int failed; // out of memory, searches walk the lists
+} DBIndex;
+
+/*
+ * Bump allocator. Nodes are never freed one by one, all blocks go at once
+ * with their context.
+ */
+typedef struct DBArena {
+	struct DBArenaBlock *block;
+} DBArena;
+
 typedef struct DBEntry {
 	struct DBEntry *next;
 	struct DBEntry *prev;
@@ -69,6 +98,7 @@ typedef struct DBFirmware {
 		DBModule *next;
 		DBModule *prev;
 	} Module;
+	struct DBContext *context;
 } DBFirmware;
 
 typedef struct DBContext {
@@ -79,6 +109,9 @@ typedef struct DBContext {
 	DBFirmware *pFirmware;
 	DBModule *pModule;
 	DBLibrary *pLibrary;
+	DBIndex index;
+	DBArena nodes;
+	DBArena strings; // interned, shared by every node with the same name
 } DBContext;
 
 void db_new_context(DBContext **result);
@@ -94,6 +127,7 @@ void db_search_or_new_module(DBFirmware *fw, const char *name, DBModule **result
 void db_new_library(DBModule *module, const char *name, DBLibrary **result);
 void db_search_library(DBModule *module, const char *name, DBLibrary **result);
 void db_search_or_new_library(DBModule *module, const char *name, DBLibrary **result);
+void db_set_library_stubname(DBLibrary *library, const char *stubname);
 
 #define LIBRARY_PRIVILEGE_NONE   (0)
 #define LIBRARY_PRIVILEGE_USER   (1)
@@ -105,6 +139,9 @@ void db_search_or_new_entry_function(DBLibrary *library, const char *name, DBEnt
 void db_new_entry_variable(DBLibrary *library, const char *name, DBEntry **result);
 void db_search_entry_variable(DBLibrary *library, const char *name, DBEntry **result);
 void db_search_or_new_entry_variable(DBLibrary *library, const char *name, DBEntry **result);
+/* Only finds entries whose NID was set through db_set_entry_nid */
+void db_search_entry_by_nid(DBLibrary *library, uint32_t nid, DBEntry **result);
+void db_set_entry_nid(DBEntry *entry, uint32_t nid);
 
 int db_execute_fw_vector(DBContext *context, int (* callback)(DBFirmware *fw, void *argp), void *argp);
 int db_execute_module_vector(DBFirmware *fw, int (* callback)(DBModule *module, void *argp), void *argp);
@@ -113,6 +150,7 @@ int db_execute_function_vector(DBLibrary *library, int (* callback)(DBEntry *ent
 int db_execute_variable_vector(DBLibrary *library, int (* callback)(DBEntry *entry, void *argp), void *argp);
 
 void db_free_context(DBContext *context);
+/* Only unlink, the memory is released by db_free_context */
 void db_free_fw(DBFirmware *fw);
 void db_free_module(DBModule *module);
 void db_free_library(DBLibrary *library);
@@ -126,6 +164,8 @@ typedef struct _VitaNIDLibStub {
 	struct _VitaNIDLibStub *prev;
 	struct NidStub *nid_stub;
 	DBLibrary *library;
+	uint64_t hash;
+	int changed;
 } _VitaNIDLibStub;
 
 typedef struct NidStub {
@@ -138,6 +178,7 @@ typedef struct NidStub {
 		_VitaNIDLibStub *prev;
 	} LibStub;
 	struct StubContext *context;
+	int changed;
 } NidStub;
 
 typedef struct StubContext {
@@ -148,6 +189,9 @@ typedef struct StubContext {
 	uint32_t firmware;
 	FILE *fp;
 	int ignored_stubname;
+	int jobs;
+	DBIndex index;
+	DBArena arena;
 } StubContext;
 
 void _vita_nid_db_search_stub_by_name(StubContext *ctx, const char *name, NidStub **stub);
@@ -155,6 +199,7 @@ void _vita_nid_db_search_or_create_stub_by_name(StubContext *ctx, const char *na
 void _vita_nid_db_stub_push_library(NidStub *stub, DBLibrary *library);
 int libstub_execute_vector(NidStub *nid_stub, int (* callback)(_VitaNIDLibStub *libstub, void *argp), void *argp);
 int stub_execute_vector(StubContext *context, int (* callback)(NidStub *nid_stub, void *argp), void *argp);
+void _vita_nid_db_free_stub_context(StubContext *ctx);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,408 @@
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vita-stub-archive.h"
+
+
+#define ELF_HEADER_SIZE     (52)
+#define ELF_SECTION_SIZE    (40)
+#define ELF_SYMBOL_SIZE     (16)
+#define ELF_NUM_SECTIONS    (5)
+
+#define EM_ARM              (40)
+#define EF_ARM_EABI_VER5    (0x05000000)
+
+#define SHT_PROGBITS        (1)
+#define SHT_SYMTAB          (2)
+#define SHT_STRTAB          (3)
+#define SHT_ARM_ATTRIBUTES  (0x70000003)
+#define SHF_ALLOC           (0x2)
+#define SHF_EXECINSTR       (0x4)
+
+#define STB_LOCAL           (0)
+#define STB_GLOBAL          (1)
+#define STT_NOTYPE          (0)
+#define STT_OBJECT          (1)
+#define STT_FUNC            (2)
+#define STT_SECTION         (3)
+
+/* Section indices */
+#define SECTION_STRTAB      (1)
+#define SECTION_STUB        (2)
+#define SECTION_ATTRIBUTES  (3)
+#define SECTION_SYMTAB      (4)
+
+#define STUB_SIZE           (16)
+/* "nop", the assembler pads .align in code with it */
+#define ARM_NOP             (0xE320F000)
+/* Offset of that padding, marked as code by a $a mapping symbol */
+#define STUB_NOP_OFFSET     (12)
+
+#define AR_HEADER_SIZE      (60)
+#define AR_NAME_SIZE        (16)
+
+/* What .arch armv7a puts in .ARM.attributes */
+static const uint8_t arm_attributes[] = {
+	0x41, 0x1C, 0x00, 0x00, 0x00, 'a', 'e', 'a', 'b', 'i', 0x00,
+	0x01, 0x12, 0x00, 0x00, 0x00,
+	0x05, '7', '-', 'A', 0x00,
+	0x06, 0x0A,
+	0x07, 'A',
+	0x08, 0x01,
+	0x09, 0x02
+};
+
+typedef struct StubArchiveMember {
+	char *name;
+	char *symbol;
+	uint8_t *data;
+	uint32_t size;
+} StubArchiveMember;
+
+struct StubArchive {
+	StubArchiveMember *members;
+	int num;
+	int allocation;
+};
+
+static void put16(uint8_t *p, uint16_t v){
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v){
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static void put32be(uint8_t *p, uint32_t v){
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t align_up(uint32_t v, uint32_t align){
+	return (v + align - 1) & ~(align - 1);
+}
+
+static void put_section(uint8_t *p, uint32_t name, uint32_t type, uint32_t flags, uint32_t offset, uint32_t size,
+	uint32_t link, uint32_t info, uint32_t align, uint32_t entsize){
+
+	put32(p +  0, name);
+	put32(p +  4, type);
+	put32(p +  8, flags);
+	put32(p + 12, 0);
+	put32(p + 16, offset);
+	put32(p + 20, size);
+	put32(p + 24, link);
+	put32(p + 28, info);
+	put32(p + 32, align);
+	put32(p + 36, entsize);
+}
+
+static void put_symbol(uint8_t *p, uint32_t name, uint32_t value, uint8_t info, uint16_t section){
+
+	put32(p +  0, name);
+	put32(p +  4, value);
+	put32(p +  8, 0);
+	p[12] = info;
+	p[13] = 0;
+	put16(p + 14, section);
+}
+
+/*
+ * Lays out an object as the assembler would for one stub:
+ * header, stub section, .ARM.attributes, .symtab, .strtab, section headers.
+ * The symbols are the stub section's, the $d and, before the nop, $a
+ * mapping symbols and then the stub itself.
+ */
+static uint8_t *build_stub_object(int is_function, const char *library_name, const char *symbol,
+	uint32_t attr, uint32_t library_nid, uint32_t nid, uint32_t *size){
+
+	const char *prefix = is_function != 0 ? ".vitalink.fstubs." : ".vitalink.vstubs.";
+	uint32_t off_stub, off_attributes, off_symtab, off_strtab, off_sections, strtab_size;
+	uint32_t name_strtab, name_symtab, name_attributes, name_stub, name_data, name_code, name_symbol;
+	uint32_t num_symbols = is_function != 0 ? 5 : 4;
+	uint8_t *obj, *p;
+
+	name_strtab     = 1;
+	name_symtab     = name_strtab + sizeof(".strtab");
+	name_attributes = name_symtab + sizeof(".symtab");
+	name_stub       = name_attributes + sizeof(".ARM.attributes");
+	name_data       = name_stub + strlen(prefix) + strlen(library_name) + 1;
+	name_code       = name_data + sizeof("$d");
+	name_symbol     = name_code + (is_function != 0 ? sizeof("$a") : 0);
+	strtab_size     = name_symbol + strlen(symbol) + 1;
+
+	off_stub       = align_up(ELF_HEADER_SIZE, STUB_SIZE);
+	off_attributes = off_stub + STUB_SIZE;
+	off_symtab     = align_up(off_attributes + sizeof(arm_attributes), 4);
+	off_strtab     = off_symtab + ELF_SYMBOL_SIZE * num_symbols;
+	off_sections   = align_up(off_strtab + strtab_size, 4);
+	*size          = off_sections + ELF_SECTION_SIZE * ELF_NUM_SECTIONS;
+
+	obj = calloc(1, *size);
+	if(obj == NULL){
+		return NULL;
+	}
+
+	memcpy(obj, "\x7F" "ELF", 4);
+	obj[4] = 1; // ELFCLASS32
+	obj[5] = 1; // ELFDATA2LSB
+	obj[6] = 1; // EV_CURRENT
+	put16(obj + 16, 1); // ET_REL
+	put16(obj + 18, EM_ARM);
+	put32(obj + 20, 1);
+	put32(obj + 32, off_sections);
+	put32(obj + 36, EF_ARM_EABI_VER5);
+	put16(obj + 40, ELF_HEADER_SIZE);
+	put16(obj + 46, ELF_SECTION_SIZE);
+	put16(obj + 48, ELF_NUM_SECTIONS);
+	put16(obj + 50, SECTION_STRTAB);
+
+	p = obj + off_stub;
+	put32(p + 0, attr);
+	put32(p + 4, library_nid);
+	put32(p + 8, nid);
+	put32(p + STUB_NOP_OFFSET, is_function != 0 ? ARM_NOP : 0);
+
+	memcpy(obj + off_attributes, arm_attributes, sizeof(arm_attributes));
+
+	p = obj + off_symtab + ELF_SYMBOL_SIZE;
+	put_symbol(p, 0, 0, (STB_LOCAL << 4) | STT_SECTION, SECTION_STUB);
+	p += ELF_SYMBOL_SIZE;
+	put_symbol(p, name_data, 0, (STB_LOCAL << 4) | STT_NOTYPE, SECTION_STUB);
+	p += ELF_SYMBOL_SIZE;
+	if(is_function != 0){
+		put_symbol(p, name_code, STUB_NOP_OFFSET, (STB_LOCAL << 4) | STT_NOTYPE, SECTION_STUB);
+		p += ELF_SYMBOL_SIZE;
+	}
+	put_symbol(p, name_symbol, 0, (STB_GLOBAL << 4) | (is_function != 0 ? STT_FUNC : STT_OBJECT), SECTION_STUB);
+
+	p = obj + off_strtab;
+	strcpy((char *)p + name_strtab, ".strtab");
+	strcpy((char *)p + name_symtab, ".symtab");
+	strcpy((char *)p + name_attributes, ".ARM.attributes");
+	sprintf((char *)p + name_stub, "%s%s", prefix, library_name);
+	strcpy((char *)p + name_data, "$d");
+	if(is_function != 0){
+		strcpy((char *)p + name_code, "$a");
+	}
+	strcpy((char *)p + name_symbol, symbol);
+
+	p = obj + off_sections;
+	put_section(p + ELF_SECTION_SIZE * SECTION_STRTAB, name_strtab, SHT_STRTAB, 0,
+		off_strtab, strtab_size, 0, 0, 1, 0);
+	put_section(p + ELF_SECTION_SIZE * SECTION_STUB, name_stub, SHT_PROGBITS,
+		is_function != 0 ? SHF_ALLOC | SHF_EXECINSTR : 0, off_stub, STUB_SIZE, 0, 0, STUB_SIZE, 0);
+	put_section(p + ELF_SECTION_SIZE * SECTION_ATTRIBUTES, name_attributes, SHT_ARM_ATTRIBUTES, 0,
+		off_attributes, sizeof(arm_attributes), 0, 0, 1, 0);
+	put_section(p + ELF_SECTION_SIZE * SECTION_SYMTAB, name_symtab, SHT_SYMTAB, 0,
+		off_symtab, ELF_SYMBOL_SIZE * num_symbols, SECTION_STRTAB, num_symbols - 1, 4, ELF_SYMBOL_SIZE);
+
+	return obj;
+}
+
+void stub_archive_new(StubArchive **result){
+
+	StubArchive *archive;
+
+	archive = malloc(sizeof(*archive));
+	if(archive != NULL){
+		archive->members = NULL;
+		archive->num = 0;
+		archive->allocation = 0;
+	}
+
+	*result = archive;
+}
+
+int stub_archive_add(StubArchive *archive, const char *member_name, int is_function,
+	const char *library_name, const char *symbol, uint32_t attr, uint32_t library_nid, uint32_t nid){
+
+	StubArchiveMember *member;
+
+	if(archive->num == archive->allocation){
+		int allocation = archive->allocation != 0 ? archive->allocation * 2 : 16;
+		member = realloc(archive->members, sizeof(*member) * allocation);
+		if(member == NULL){
+			return -1;
+		}
+		archive->members = member;
+		archive->allocation = allocation;
+	}
+
+	member = &(archive->members[archive->num]);
+	member->name = strdup(member_name);
+	member->symbol = strdup(symbol);
+	member->data = build_stub_object(is_function, library_name, symbol, attr, library_nid, nid, &member->size);
+	if(member->name == NULL || member->symbol == NULL || member->data == NULL){
+		free(member->name);
+		free(member->symbol);
+		free(member->data);
+		return -1;
+	}
+
+	archive->num++;
+
+	return 0;
+}
+
+static int write_ar_header(FILE *fp, const char *name, const char *mode, uint32_t size){
+
+	char header[AR_HEADER_SIZE + 1];
+	// The long name table has no date or owner
+	const char *zero = strcmp(name, "//") == 0 ? "" : "0";
+
+	snprintf(header, sizeof(header), "%-16s%-12s%-6s%-6s%-8s%-10u`\n", name, zero, zero, zero, mode, size);
+
+	return fwrite(header, AR_HEADER_SIZE, 1, fp) == 1 ? 0 : -1;
+}
+
+static int write_ar_data(FILE *fp, const void *data, uint32_t size){
+
+	if(size != 0 && fwrite(data, size, 1, fp) != 1){
+		return -1;
+	}
+
+	// Members start on even offsets
+	if((size & 1) != 0 && fputc('\n', fp) == EOF){
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * GNU ar layout: "/" symbol index, "//" table for names over 15 characters,
+ * then the members. Timestamps and owners are zero like ar's D modifier.
+ */
+int stub_archive_write(StubArchive *archive, const char *path){
+
+	uint8_t *index = NULL;
+	char *names = NULL;
+	uint32_t index_size, names_size, offset;
+	uint32_t *name_offsets = NULL;
+	char member_name[AR_NAME_SIZE + 1];
+	FILE *fp = NULL;
+	int res = -1;
+
+	index_size = 4 + 4 * archive->num;
+	names_size = 0;
+	for(int i=0;i<archive->num;i++){
+		index_size += strlen(archive->members[i].symbol) + 1;
+		if(strlen(archive->members[i].name) + 1 > AR_NAME_SIZE){
+			names_size += strlen(archive->members[i].name) + 2;
+		}
+	}
+
+	// Like ar, the padding of the index and name table counts in their size
+	index_size = align_up(index_size, 2);
+	index = calloc(1, index_size);
+	names = malloc(names_size + 1);
+	name_offsets = malloc(sizeof(uint32_t) * (archive->num + 1));
+	if(index == NULL || names == NULL || name_offsets == NULL){
+		goto end;
+	}
+
+	// Member headers come after the index and the long name table
+	offset = 8;
+	if(archive->num != 0){
+		offset += AR_HEADER_SIZE + align_up(index_size, 2);
+	}
+	if(names_size != 0){
+		offset += AR_HEADER_SIZE + align_up(names_size, 2);
+	}
+
+	put32be(index, archive->num);
+	uint8_t *symbol_names = index + 4 + 4 * archive->num;
+	names_size = 0;
+
+	for(int i=0;i<archive->num;i++){
+		StubArchiveMember *member = &(archive->members[i]);
+
+		put32be(index + 4 + 4 * i, offset);
+		strcpy((char *)symbol_names, member->symbol);
+		symbol_names += strlen(member->symbol) + 1;
+
+		name_offsets[i] = names_size;
+		if(strlen(member->name) + 1 > AR_NAME_SIZE){
+			names_size += sprintf(names + names_size, "%s/\n", member->name);
+		}
+
+		offset += AR_HEADER_SIZE + align_up(member->size, 2);
+	}
+	if((names_size & 1) != 0){
+		names[names_size++] = '\n';
+	}
+
+	fp = fopen(path, "wb");
+	if(fp == NULL){
+		goto end;
+	}
+
+	if(fwrite("!<arch>\n", 8, 1, fp) != 1){
+		goto end;
+	}
+
+	if(archive->num != 0){
+		if(write_ar_header(fp, "/", "0", index_size) < 0 || write_ar_data(fp, index, index_size) < 0){
+			goto end;
+		}
+	}
+
+	if(names_size != 0){
+		if(write_ar_header(fp, "//", "", names_size) < 0 || write_ar_data(fp, names, names_size) < 0){
+			goto end;
+		}
+	}
+
+	for(int i=0;i<archive->num;i++){
+		StubArchiveMember *member = &(archive->members[i]);
+
+		if(strlen(member->name) + 1 > AR_NAME_SIZE){
+			snprintf(member_name, sizeof(member_name), "/%u", name_offsets[i]);
+		}else{
+			snprintf(member_name, sizeof(member_name), "%s/", member->name);
+		}
+
+		if(write_ar_header(fp, member_name, "644", member->size) < 0 || write_ar_data(fp, member->data, member->size) < 0){
+			goto end;
+		}
+	}
+
+	res = 0;
+
+end:
+	if(fp != NULL && fclose(fp) != 0){
+		res = -1;
+	}
+	if(res < 0 && fp != NULL){
+		remove(path);
+	}
+
+	free(name_offsets);
+	free(names);
+	free(index);
+
+	return res;
+}
+
+void stub_archive_free(StubArchive *archive){
+
+	if(archive == NULL){
+		return;
+	}
+
+	for(int i=0;i<archive->num;i++){
+		free(archive->members[i].name);
+		free(archive->members[i].symbol);
+		free(archive->members[i].data);
+	}
+
+	free(archive->members);
+	free(archive);
+}
@@ -0,0 +1,31 @@
+#ifndef _VITA_STUB_ARCHIVE_H_
+#define _VITA_STUB_ARCHIVE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*
+ * Builds lib*_stub.a archives in memory, one ARM ELF relocatable object per
+ * stub holding the same 16-byte .vitalink record the generated .S assembles
+ * to, so no assembler or ar has to be run.
+ */
+typedef struct StubArchive StubArchive;
+
+void stub_archive_new(StubArchive **result);
+/* attr is the record's first word, library version << 16 | flags */
+int stub_archive_add(StubArchive *archive, const char *member_name, int is_function,
+	const char *library_name, const char *symbol, uint32_t attr, uint32_t library_nid, uint32_t nid);
+/* Writes the archive with a symbol index, as ar and ranlib would */
+int stub_archive_write(StubArchive *archive, const char *path);
+void stub_archive_free(StubArchive *archive);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _VITA_STUB_ARCHIVE_H_ */
@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "segment-compress.h"
+
+#define DEFLATE_WINDOW_SIZE (64 * 1024)
+
+struct segment_pool {
+	segment_job *jobs;
+	int count;
+	int next;
+	int released;
+	int window;
+	int aborted;
+
+	pthread_t *threads;
+	int num_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+#ifdef HAVE_LIBDEFLATE
+static int compress_libdeflate(segment_job *job, segment_sink sink, void *ctx) {
+	struct libdeflate_compressor *compressor;
+	unsigned char *buf;
+	size_t bound, length;
+	int status = Z_OK;
+
+	compressor = libdeflate_alloc_compressor(job->level);
+	if (!compressor)
+		return Z_MEM_ERROR;
+
+	// libdeflate only compresses in one shot
+	bound = libdeflate_zlib_compress_bound(compressor, job->size);
+	buf = malloc(bound);
+	if (!buf) {
+		libdeflate_free_compressor(compressor);
+		return Z_MEM_ERROR;
+	}
+
+	job->length = 0;
+	length = libdeflate_zlib_compress(compressor, job->data, job->size, buf, bound);
+	if (length == 0)
+		status = Z_BUF_ERROR;
+	else if (!sink(ctx, buf, length))
+		status = Z_ERRNO;
+	else
+		job->length = length;
+
+	free(buf);
+	libdeflate_free_compressor(compressor);
+	return status;
+}
+#endif
+
+static int compress_zlib(segment_job *job, segment_sink sink, void *ctx) {
+	unsigned char window[DEFLATE_WINDOW_SIZE];
+	z_stream strm = { 0 };
+	size_t have;
+	int ret;
+
+	ret = deflateInit(&strm, job->level);
+	if (ret != Z_OK)
+		return ret;
+
+	// Same stream as compress2(), the output window size doesn't change the bytes
+	strm.next_in = (unsigned char *)job->data;
+	strm.avail_in = job->size;
+	job->length = 0;
+	do {
+		strm.next_out = window;
+		strm.avail_out = sizeof(window);
+		ret = deflate(&strm, Z_FINISH);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			break;
+
+		have = sizeof(window) - strm.avail_out;
+		if (have && !sink(ctx, window, have)) {
+			ret = Z_ERRNO;
+			break;
+		}
+		job->length += have;
+	} while (ret != Z_STREAM_END);
+
+	deflateEnd(&strm);
+	return ret == Z_STREAM_END ? Z_OK : ret;
+}
+
+int compress_segment(segment_job *job, segment_sink sink, void *ctx) {
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef HAVE_LIBDEFLATE
+	if (job->backend == COMPRESSOR_LIBDEFLATE)
+		job->status = compress_libdeflate(job, sink, ctx);
+	else
+#endif
+		job->status = compress_zlib(job, sink, ctx);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	job->msecs = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+	return job->status == Z_OK;
+}
+
+static int buffer_sink(void *ctx, const void *buf, size_t len) {
+	segment_job *job = ctx;
+	size_t used = job->length;
+	unsigned char *grown;
+
+	if (used + len > job->capacity) {
+		size_t capacity = job->capacity ? job->capacity : DEFLATE_WINDOW_SIZE;
+		while (capacity < used + len)
+			capacity *= 2;
+		grown = realloc(job->buf, capacity);
+		if (!grown)
+			return 0;
+		job->buf = grown;
+		job->capacity = capacity;
+	}
+
+	// job->length is advanced by the compressor once the sink accepted the data
+	memcpy(job->buf + used, buf, len);
+	return 1;
+}
+
+static void *compress_worker(void *arg) {
+	segment_pool *pool = arg;
+	segment_job *job;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->aborted && pool->next < pool->count && pool->next >= pool->released + pool->window)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (pool->aborted || pool->next >= pool->count) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		job = &pool->jobs[i];
+		compress_segment(job, buffer_sink, job);
+
+		pthread_mutex_lock(&pool->lock);
+		job->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+segment_pool *segment_pool_start(segment_job *jobs, int count, int num_threads) {
+	segment_pool *pool;
+
+	if (num_threads > count)
+		num_threads = count;
+	if (num_threads < 1)
+		return NULL;
+
+	pool = calloc(1, sizeof(segment_pool));
+	if (!pool)
+		return NULL;
+	pool->threads = calloc(num_threads, sizeof(pthread_t));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+
+	pool->jobs = jobs;
+	pool->count = count;
+	pool->window = num_threads;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (; pool->num_threads < num_threads; pool->num_threads++) {
+		if (pthread_create(&pool->threads[pool->num_threads], NULL, compress_worker, pool) != 0)
+			break;
+	}
+
+	if (pool->num_threads == 0) {
+		segment_pool_finish(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+segment_job *segment_pool_wait(segment_pool *pool, int index) {
+	segment_job *job = &pool->jobs[index];
+
+	pthread_mutex_lock(&pool->lock);
+	while (!job->done)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	return job;
+}
+
+void segment_pool_release(segment_pool *pool, int index) {
+	segment_job *job = &pool->jobs[index];
+
+	free(job->buf);
+	job->buf = NULL;
+	job->capacity = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->released = index + 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void segment_pool_finish(segment_pool *pool) {
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->aborted = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	for (int i = 0; i < pool->count; i++) {
+		free(pool->jobs[i].buf);
+		pool->jobs[i].buf = NULL;
+	}
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
@@ -0,0 +1,45 @@
+#ifndef SEGMENT_COMPRESS_H
+#define SEGMENT_COMPRESS_H
+
+#include <stddef.h>
+
+typedef enum {
+	COMPRESSOR_ZLIB,
+	COMPRESSOR_LIBDEFLATE
+} compressor_backend;
+
+/* Receives the compressed stream piece by piece, returns 0 on failure */
+typedef int (*segment_sink)(void *ctx, const void *buf, size_t len);
+
+typedef struct {
+	const unsigned char *data;
+	size_t size;
+	compressor_backend backend;
+	int level;
+
+	/* Output of a job compressed ahead on a worker, until it is released */
+	unsigned char *buf;
+	size_t capacity;
+
+	size_t length;
+	int status;		/* Z_OK on success */
+	int done;
+	double msecs;
+} segment_job;
+
+typedef struct segment_pool segment_pool;
+
+/* Compress job->data as a single zlib stream, passing the output to sink
+ * through a fixed-size window */
+int compress_segment(segment_job *job, segment_sink sink, void *ctx);
+
+/* Compress jobs in order on num_threads workers, keeping at most
+ * num_threads finished or running jobs ahead of the consumer.
+ * Returns NULL when no worker could be started. */
+segment_pool *segment_pool_start(segment_job *jobs, int count, int num_threads);
+/* Wait for jobs[index]; its output stays in job->buf until released */
+segment_job *segment_pool_wait(segment_pool *pool, int index);
+void segment_pool_release(segment_pool *pool, int index);
+void segment_pool_finish(segment_pool *pool);
+
+#endif
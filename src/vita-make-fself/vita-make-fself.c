@@ -4,11 +4,17 @@
 #include <inttypes.h>
 #include <zlib.h>
 
+#ifndef __MINGW32__
+#include <sys/mman.h>
+#define HAVE_FILE_MMAP
+#endif
+
 #include "vita-export.h"
 #include "vita-elf-create/sce-elf.h"
 #include "utils/endian-utils.h"
 #include "self.h"
 #include "utils/sha256.h"
+#include "segment-compress.h"
 
 const uint8_t digest_constant[0x14] = {
 	0x62, 0x7C, 0xB1, 0x80, 0x8A, 0xB9, 0x38, 0xE3, 0x2C, 0x8C, 0x09, 0x17, 0x08, 0x72, 0x6A, 0x57, 0x9E, 0x25, 0x86, 0xE4
@@ -22,16 +28,82 @@ typedef enum SceSelfType {
 	SCE_SELF_TYPE_USER     = 0xD
 } SceSelfType;
 
+// Hash the input up to end, if that part was not hashed yet
+static void hash_input_until(sha256_digest *digest, const char *input, size_t size, size_t *hashed, size_t end) {
+	if (end > size)
+		end = size;
+	if (*hashed < end) {
+		sha256_digest_update(digest, input + *hashed, end - *hashed);
+		*hashed = end;
+	}
+}
+
+static int file_sink(void *ctx, const void *buf, size_t len) {
+	return fwrite(buf, len, 1, (FILE *)ctx) == 1;
+}
+
+// The input is mapped privately, so the module NID can be patched in place
+static char *load_input(FILE *fin, size_t *size, int *mapped) {
+	char *input;
+
+	fseek(fin, 0, SEEK_END);
+	*size = ftell(fin);
+	fseek(fin, 0, SEEK_SET);
+	*mapped = 0;
+
+#ifdef HAVE_FILE_MMAP
+	if (*size > 0) {
+		input = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fin), 0);
+		if (input != MAP_FAILED) {
+			*mapped = 1;
+			return input;
+		}
+	}
+#endif
+
+	input = calloc(1, *size);
+	if (!input) {
+		perror("Failed to allocate buffer for input file");
+		return NULL;
+	}
+	if (fread(input, *size, 1, fin) != 1) {
+		static const char s[] = "Failed to read input file";
+		if (feof(fin))
+			fprintf(stderr, "%s: unexpected end of file\n", s);
+		else
+			perror(s);
+		free(input);
+		return NULL;
+	}
+
+	return input;
+}
+
+static void free_input(char *input, size_t size, int mapped) {
+#ifdef HAVE_FILE_MMAP
+	if (mapped) {
+		munmap(input, size);
+		return;
+	}
+#endif
+	free(input);
+}
+
 void usage(const char **argv) {
-	fprintf(stderr, "usage: %s [-s|-ss|-a 0x2XXXXXXXXXXXXXXX] [-c] [-na] input.velf output-eboot.bin\n", argv[0] ? argv[0] : "vita-make-fself");
+	fprintf(stderr, "usage: %s [-s|-ss|-a 0x2XXXXXXXXXXXXXXX] [-c[=level]] [-j N] [-v] [-na] input.velf output-eboot.bin\n", argv[0] ? argv[0] : "vita-make-fself");
 	fprintf(stderr, "\t-s : Generate a safe eboot.bin. A safe eboot.bin does not have access\n\tto restricted APIs and important parts of the filesystem.\n");
 	fprintf(stderr, "\t-ss: Generate a secret-safe eboot.bin. Do not use this option if you don't know what it does.\n");
 	fprintf(stderr, "\t-a : Authid for more permissions (SceShell: 0x2800000000000001).\n");
-	fprintf(stderr, "\t-c : Enable compression.\n");
+	fprintf(stderr, "\t-c : Enable compression. An optional level can be given as -c=1 (fastest) to -c=9 (default, smallest).\n");
+#ifdef HAVE_LIBDEFLATE
+	fprintf(stderr, "\t--compressor: Compression backend, zlib (default) or libdeflate (levels up to 12).\n");
+#endif
+	fprintf(stderr, "\t-j : Number of threads used to compress segments (default 1).\n");
 	fprintf(stderr, "\t-m : Memory budget for the application in kilobytes. (Normal app: 0, System mode app: 0x1000 - 0x12800)\n");
 	fprintf(stderr, "\t-pm: Physically contiguous memory budget for the application in kilobytes. (Note: The budget will be subtracted from standard memory budget)\n");
 	fprintf(stderr, "\t-at: ATTRIBUTE word in Control Info section 6.\n");
 	fprintf(stderr, "\t-na: Disable ASLR.\n");
+	fprintf(stderr, "\t-v : Report size and time of each compressed segment.\n");
 	exit(1);
 }
 
@@ -39,6 +111,13 @@ int main(int argc, const char **argv) {
 	const char *input_path, *output_path;
 	FILE *fin = NULL;
 	FILE *fout = NULL;
+	char *input = NULL;
+	size_t sz = 0;
+	int mapped = 0;
+	segment_job *jobs = NULL;
+	segment_pool *pool = NULL;
+	sha256_digest digest, nid_digest;
+	size_t hashed = 0;
 	uint32_t mod_nid;
 
 	argc--;
@@ -48,6 +127,10 @@ int main(int argc, const char **argv) {
 
 	int safe = 0;
 	int compressed = 0;
+	int compress_level = Z_BEST_COMPRESSION;
+	compressor_backend backend = COMPRESSOR_ZLIB;
+	int num_threads = 1;
+	int verbose = 0;
 	int noaslr = 0;
 	int self_type = SCE_SELF_TYPE_NPDRM;
 	uint32_t mem_budget = 0;
@@ -61,6 +144,35 @@ int main(int argc, const char **argv) {
 			safe = 3;
 		} else if (strcmp(*argv, "-c") == 0) {
 			compressed = 1;
+		} else if (strncmp(*argv, "-c=", 3) == 0) {
+			compressed = 1;
+			compress_level = strtol(*argv + 3, NULL, 0);
+		} else if (strcmp(*argv, "--compressor") == 0) {
+			argc--;
+			argv++;
+
+			if (argc > 2) {
+				if (strcmp(*argv, "zlib") == 0) {
+					backend = COMPRESSOR_ZLIB;
+#ifdef HAVE_LIBDEFLATE
+				} else if (strcmp(*argv, "libdeflate") == 0) {
+					backend = COMPRESSOR_LIBDEFLATE;
+#endif
+				} else {
+					fprintf(stderr, "Unsupported compressor %s\n", *argv);
+					usage(argv);
+				}
+			}
+		} else if (strcmp(*argv, "-v") == 0) {
+			verbose = 1;
+		} else if (strcmp(*argv, "-j") == 0) {
+			argc--;
+			argv++;
+
+			if (argc > 2)
+				num_threads = strtol(*argv, NULL, 0);
+			if (num_threads < 1)
+				num_threads = 1;
 		} else if (strcmp(*argv, "-a") == 0) {
 			argc--;
 			argv++;
@@ -99,9 +211,9 @@ int main(int argc, const char **argv) {
 	input_path = argv[0];
 	output_path = argv[1];
 
-	if (sha256_32_file(input_path, &mod_nid) != 0) {
-		perror("Cannot generate module NID");
-		goto error;
+	if (compress_level < 1 || compress_level > (backend == COMPRESSOR_LIBDEFLATE ? 12 : 9)) {
+		fprintf(stderr, "Invalid compression level %d\n", compress_level);
+		usage(argv);
 	}
 
 	fin = fopen(input_path, "rb");
@@ -109,44 +221,44 @@ int main(int argc, const char **argv) {
 		perror("Failed to open input file");
 		goto error;
 	}
-	fseek(fin, 0, SEEK_END);
-	size_t sz = ftell(fin);
-	fseek(fin, 0, SEEK_SET);
-
-	char *input = calloc(1, sz);
-	if (!input) {
-		perror("Failed to allocate buffer for input file");
-		goto error;
-	}
-	if (fread(input, sz, 1, fin) != 1) {
-		static const char s[] = "Failed to read input file";
-		if (feof(fin))
-			fprintf(stderr, "%s: unexpected end of file\n", s);
-		else
-			perror(s);
+	input = load_input(fin, &sz, &mapped);
+	if (!input)
 		goto error;
-	}
 	fclose(fin);
 	fin = NULL;
 
 	Elf32_Ehdr *ehdr = (Elf32_Ehdr*)input;
 
-	// write module nid
+	sce_module_info_raw *info = NULL;
 	if (ehdr->e_type == ET_SCE_EXEC) {
 		Elf32_Phdr *phdr = (Elf32_Phdr*)(input + ehdr->e_phoff);
-		sce_module_info_raw *info = (sce_module_info_raw *)(input + phdr->p_offset + phdr->p_paddr);
-		info->module_nid = htole32(mod_nid);
+		info = (sce_module_info_raw *)(input + phdr->p_offset + phdr->p_paddr);
 	} else if (ehdr->e_type == ET_SCE_RELEXEC) {
 		int seg = ehdr->e_entry >> 30;
 		int off = ehdr->e_entry & 0x3fffffff;
 		Elf32_Phdr *phdr = (Elf32_Phdr*)(input + ehdr->e_phoff + seg * ehdr->e_phentsize);
-		sce_module_info_raw *info = (sce_module_info_raw *)(input + phdr->p_offset + off);
-		info->module_nid = htole32(mod_nid);
+		info = (sce_module_info_raw *)(input + phdr->p_offset + off);
+	}
+	if (info && (char *)(&info->module_nid + 1) > input + sz) {
+		fprintf(stderr, "Module info is outside of the input file\n");
+		goto error;
 	}
 
-	uint8_t elf_digest[0x20];
+	// The module NID is derived from the original input and the ELF digest from
+	// the input with the NID written in, so what precedes module_nid is hashed once
+	hashed = info ? (size_t)((char *)&info->module_nid - input) : sz;
+	sha256_digest_init(&digest);
+	sha256_digest_update(&digest, input, hashed);
+	sha256_digest_fork(&digest, &nid_digest);
+	sha256_digest_update(&nid_digest, input + hashed, sz - hashed);
+	mod_nid = sha256_digest_module_nid(&nid_digest);
 
-	sha256_vector(1, (uint8_t *[]){input}, (size_t[]){sz}, elf_digest);
+	// write module nid
+	if (info)
+		info->module_nid = htole32(mod_nid);
+
+	// the rest of the digest is computed while the segments are written
+	uint8_t elf_digest[0x20];
 
 	SCE_header hdr = { 0 };
 	hdr.magic = 0x454353; // "SCE\0"
@@ -205,7 +317,6 @@ int main(int argc, const char **argv) {
 	control_4.common.size = sizeof(control_4);
 	control_4.common.unk = 1;
 	memcpy(control_4.constant, digest_constant, sizeof(control_4.constant));
-	memcpy(control_4.elf_digest, elf_digest, sizeof(control_4.elf_digest));
 	control_4.min_required_fw = 0LL; // on fself
 
 	SCE_controlinfo_5 control_5 = { 0 };
@@ -270,11 +381,13 @@ int main(int argc, const char **argv) {
 	// copy elf phdr in same format
 	fseek(fout, hdr.phdr_offset, SEEK_SET);
 	for (int i = 0; i < ehdr->e_phnum; ++i) {
-		Elf32_Phdr *phdr = (Elf32_Phdr*)(input + ehdr->e_phoff + ehdr->e_phentsize * i);
+		// on a copy, the input is still to be hashed for the ELF digest
+		Elf32_Phdr phdr;
+		memcpy(&phdr, input + ehdr->e_phoff + ehdr->e_phentsize * i, sizeof(phdr));
 		// but fixup alignment, TODO: fix in toolchain
-		if (phdr->p_align > 0x1000)
-			phdr->p_align = 0x1000;
-		if (fwrite(phdr, sizeof(*phdr), 1, fout) != 1) {
+		if (phdr.p_align > 0x1000)
+			phdr.p_align = 0x1000;
+		if (fwrite(&phdr, sizeof(phdr), 1, fout) != 1) {
 			perror("Failed to write phdr");
 			goto error;
 		}
@@ -298,13 +411,23 @@ int main(int argc, const char **argv) {
 		goto error;
 	}
 
-	fseek(fout, hdr.controlinfo_offset, SEEK_SET);
-	fwrite(&control_4, sizeof(control_4), 1, fout);
-	if (self_type != SCE_SELF_TYPE_SECURITY) {
-		fwrite(&control_5, sizeof(control_5), 1, fout);
+	if (compressed) {
+		jobs = calloc(ehdr->e_phnum, sizeof(segment_job));
+		if (!jobs) {
+			perror("malloc failed");
+			goto error;
+		}
+		for (int i = 0; i < ehdr->e_phnum; ++i) {
+			Elf32_Phdr *phdr = (Elf32_Phdr*)(input + ehdr->e_phoff + ehdr->e_phentsize * i);
+			jobs[i].data = (unsigned char *)input + phdr->p_offset;
+			jobs[i].size = phdr->p_filesz;
+			jobs[i].backend = backend;
+			jobs[i].level = compress_level;
+		}
+		// a single thread streams each segment straight into the output
+		if (num_threads > 1)
+			pool = segment_pool_start(jobs, ehdr->e_phnum, num_threads);
 	}
-	fwrite(&control_6, sizeof(control_6), 1, fout);
-	fwrite(&control_7, sizeof(control_7), 1, fout);
 
 	fseek(fout, offset_to_real_elf, SEEK_SET);
 
@@ -314,25 +437,27 @@ int main(int argc, const char **argv) {
 		sinfo.offset = ftell(fout);
 		sinfo.encryption = 2;
 
+		hash_input_until(&digest, input, sz, &hashed, phdr->p_offset + phdr->p_filesz);
+
 		if(compressed) {
-			unsigned char *buf = malloc(2 * phdr->p_filesz + 12);
-			if(!buf) {
-				perror("malloc failed");
-				goto error;
-			}
-			sinfo.length = 2 * phdr->p_filesz + 12;
-			if (compress2(buf, (uLongf *)&sinfo.length, (unsigned char *)input + phdr->p_offset, phdr->p_filesz, Z_BEST_COMPRESSION) != Z_OK) {
-				free(buf);
+			if (pool) {
+				segment_job *job = segment_pool_wait(pool, i);
+				if (job->status != Z_OK || fwrite(job->buf, job->length, 1, fout) != 1) {
+					perror("compress failed");
+					goto error;
+				}
+				segment_pool_release(pool, i);
+			} else if (!compress_segment(&jobs[i], file_sink, fout)) {
 				perror("compress failed");
 				goto error;
 			}
+			sinfo.length = jobs[i].length;
 			sinfo.compression = 2;
-			if (fwrite(buf, sinfo.length, 1, fout) != 1) {
-				free(buf);
-				perror("Failed to write segment to fself");
-				goto error;
+			if (verbose) {
+				printf("segment %d: %lu -> %lu bytes (%.1f%%) in %.3f ms\n", i,
+					(unsigned long)jobs[i].size, (unsigned long)jobs[i].length,
+					jobs[i].size ? 100.0 * jobs[i].length / jobs[i].size : 0.0, jobs[i].msecs);
 			}
-			free(buf);
 		} else {
 			sinfo.length = phdr->p_filesz;
 			sinfo.compression = 1;
@@ -366,6 +491,19 @@ int main(int argc, const char **argv) {
 		}
 	}
 
+	// the control info goes before the segments but needs the digest of the whole input
+	hash_input_until(&digest, input, sz, &hashed, sz);
+	sha256_digest_hash(&digest, elf_digest);
+	memcpy(control_4.elf_digest, elf_digest, sizeof(control_4.elf_digest));
+
+	fseek(fout, hdr.controlinfo_offset, SEEK_SET);
+	fwrite(&control_4, sizeof(control_4), 1, fout);
+	if (self_type != SCE_SELF_TYPE_SECURITY) {
+		fwrite(&control_5, sizeof(control_5), 1, fout);
+	}
+	fwrite(&control_6, sizeof(control_6), 1, fout);
+	fwrite(&control_7, sizeof(control_7), 1, fout);
+
 	fseek(fout, 0, SEEK_END);
 	hdr.self_filesize = ftell(fout);
 	fseek(fout, 0, SEEK_SET);
@@ -375,9 +513,16 @@ int main(int argc, const char **argv) {
 	}
 
 	fclose(fout);
+	segment_pool_finish(pool);
+	free(jobs);
+	free_input(input, sz, mapped);
 
 	return 0;
 error:
+	segment_pool_finish(pool);
+	free(jobs);
+	if (input)
+		free_input(input, sz, mapped);
 	if (fin)
 		fclose(fin);
 	if (fout)
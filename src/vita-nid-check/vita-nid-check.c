@@ -114,21 +114,8 @@ int module_callback(DBModule *module, void *argp){
 	return db_execute_library_vector(module, library_callback, argp);
 }
 
-int check_in_same_library(DBEntry *entry, void *argp){
-
-	VitaNIDCheckParam *param = argp;
-
-	if(strcmp(param->current.name, entry->name) == 0){
-		return -1;
-	}
-
-	return 0;
-}
-
 int _check_entry(VitaNIDCheckParam *param, const char *name, uint32_t nid, int type){
 
-	int res;
-
 	param->current.name = name;
 	param->current.nid  = nid;
 	param->current.type = type;
@@ -153,14 +140,13 @@ int _check_entry(VitaNIDCheckParam *param, const char *name, uint32_t nid, int t
 	/*
 	 * RULE: Library cannot have same name entry
 	 */
-	res = db_execute_function_vector(param->current.context->pLibrary, check_in_same_library, param);
-	if(res < 0){
-		return res;
+	db_search_entry_function(param->current.context->pLibrary, name, &e);
+	if(e == NULL){
+		db_search_entry_variable(param->current.context->pLibrary, name, &e);
 	}
 
-	res = db_execute_variable_vector(param->current.context->pLibrary, check_in_same_library, param);
-	if(res < 0){
-		return res;
+	if(e != NULL){
+		return -1;
 	}
 
 	/*
@@ -243,7 +229,7 @@ int entry_function(const char *name, uint32_t nid, void *argp){
 		return -1;
 	}
 
-	entry->nid = nid;
+	db_set_entry_nid(entry, nid);
 
 	return 0;
 }
@@ -266,7 +252,7 @@ int entry_variable(const char *name, uint32_t nid, void *argp){
 		return -1;
 	}
 
-	entry->nid = nid;
+	db_set_entry_nid(entry, nid);
 
 	return 0;
 }
@@ -0,0 +1,403 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "entry-compress.h"
+
+#define READ_CHUNK_SIZE (256 * 1024)
+
+#define PROBE_SIZE (64 * 1024)
+#define PROBE_LEVEL 1
+/* Deflate has to save at least this much of the probed data, in percent */
+#define PROBE_MIN_SAVING 3
+
+struct entry_pool {
+	vpk_entry *entries;
+	int count;
+	int next_probe;
+	int probed;
+	int next;
+	int held;
+	uint64_t held_size;
+	int window;
+	uint64_t window_size;
+	uint64_t max_buffered;
+	int level;
+	int aborted;
+
+	pthread_t *threads;
+	int num_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static int reserve_output(vpk_entry *entry, size_t needed)
+{
+	size_t capacity = entry->capacity ? entry->capacity : READ_CHUNK_SIZE;
+	unsigned char *grown;
+
+	if (entry->capacity >= needed)
+		return 1;
+
+	while (capacity < needed)
+		capacity *= 2;
+	grown = realloc(entry->buf, capacity);
+	if (!grown)
+		return 0;
+
+	entry->buf = grown;
+	entry->capacity = capacity;
+	return 1;
+}
+
+void probe_entry(vpk_entry *entry)
+{
+	z_stream strm = { 0 };
+	unsigned char *in, *out = NULL;
+	size_t read = 0, bound;
+	FILE *fp;
+
+	if (entry->method != ENTRY_PROBE)
+		return;
+
+	// On any error deflate, compress_entry() reports it
+	entry->method = ENTRY_DEFLATE;
+
+	in = malloc(PROBE_SIZE);
+	fp = fopen(entry->src, "rb");
+	if (in && fp)
+		read = fread(in, 1, PROBE_SIZE, fp);
+	if (fp)
+		fclose(fp);
+
+	if (read == 0) {
+		if (entry->size == 0)
+			entry->method = ENTRY_STORE;
+		free(in);
+		return;
+	}
+
+	if (deflateInit2(&strm, PROBE_LEVEL, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+		bound = deflateBound(&strm, read);
+		out = malloc(bound);
+		if (out) {
+			strm.next_in = in;
+			strm.avail_in = read;
+			strm.next_out = out;
+			strm.avail_out = bound;
+			if (deflate(&strm, Z_FINISH) == Z_STREAM_END
+					&& strm.total_out * 100 > read * (100 - PROBE_MIN_SAVING))
+				entry->method = ENTRY_STORE;
+		}
+		deflateEnd(&strm);
+	}
+
+	free(out);
+	free(in);
+}
+
+int crc_entry(const vpk_entry *entry, uint32_t *crc)
+{
+	unsigned char *chunk;
+	size_t read;
+	FILE *fp;
+	int ret;
+
+	chunk = malloc(READ_CHUNK_SIZE);
+	if (!chunk)
+		return 0;
+	fp = fopen(entry->src, "rb");
+	if (!fp) {
+		free(chunk);
+		return 0;
+	}
+
+	*crc = crc32(0, NULL, 0);
+	while ((read = fread(chunk, 1, READ_CHUNK_SIZE, fp)) > 0)
+		*crc = crc32(*crc, chunk, read);
+	ret = !ferror(fp);
+
+	fclose(fp);
+	free(chunk);
+	return ret;
+}
+
+int deflate_entry(vpk_entry *entry, int level, entry_output output, void *arg)
+{
+	z_stream strm = { 0 };
+	unsigned char *chunk, *out;
+	size_t read;
+	FILE *fp;
+	int flush;
+
+	entry->size = 0;
+	entry->comp_size = 0;
+	entry->crc = crc32(0, NULL, 0);
+	entry->status = 0;
+
+	chunk = malloc(READ_CHUNK_SIZE * 2);
+	if (!chunk) {
+		entry->status = ENOMEM;
+		return 0;
+	}
+	out = chunk + READ_CHUNK_SIZE;
+
+	fp = fopen(entry->src, "rb");
+	if (!fp) {
+		entry->status = errno;
+		free(chunk);
+		return 0;
+	}
+
+	// Raw deflate, the zip headers carry the size and CRC
+	if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		entry->status = ENOMEM;
+		fclose(fp);
+		free(chunk);
+		return 0;
+	}
+
+	do {
+		read = fread(chunk, 1, READ_CHUNK_SIZE, fp);
+		if (ferror(fp)) {
+			entry->status = errno ? errno : EIO;
+			break;
+		}
+		entry->size += read;
+		entry->crc = crc32(entry->crc, chunk, read);
+		flush = feof(fp) ? Z_FINISH : Z_NO_FLUSH;
+
+		strm.next_in = chunk;
+		strm.avail_in = read;
+		do {
+			strm.next_out = out;
+			strm.avail_out = READ_CHUNK_SIZE;
+			deflate(&strm, flush);
+			if (strm.avail_out < READ_CHUNK_SIZE
+					&& !output(arg, out, READ_CHUNK_SIZE - strm.avail_out)) {
+				entry->status = errno ? errno : EIO;
+				break;
+			}
+			entry->comp_size += READ_CHUNK_SIZE - strm.avail_out;
+		} while (strm.avail_out == 0);
+	} while (flush != Z_FINISH && entry->status == 0);
+
+	deflateEnd(&strm);
+	fclose(fp);
+	free(chunk);
+	return entry->status == 0;
+}
+
+static int append_output(void *arg, const unsigned char *data, size_t size)
+{
+	vpk_entry *entry = arg;
+
+	if (!reserve_output(entry, entry->comp_size + size)) {
+		errno = ENOMEM;
+		return 0;
+	}
+	memcpy(entry->buf + entry->comp_size, data, size);
+	return 1;
+}
+
+int compress_entry(vpk_entry *entry, int level)
+{
+	unsigned char *trimmed;
+
+	if (!deflate_entry(entry, level, append_output, entry))
+		return 0;
+
+	// Only what the entry needs stays held until it is written
+	if (entry->comp_size > 0 && entry->comp_size < entry->capacity) {
+		trimmed = realloc(entry->buf, entry->comp_size);
+		if (trimmed) {
+			entry->buf = trimmed;
+			entry->capacity = entry->comp_size;
+		}
+	}
+	return 1;
+}
+
+/* Settle the method, entries too large to buffer go to the caller */
+static void settle_entry(entry_pool *pool, vpk_entry *entry)
+{
+	probe_entry(entry);
+	if (entry->method == ENTRY_DEFLATE && pool->max_buffered && entry->size > pool->max_buffered)
+		entry->method = ENTRY_STREAM;
+}
+
+/* Only entries that get deflated take up the window, the rest go through.
+ * Whatever its size, an entry fits in an empty window. */
+static int window_full(const entry_pool *pool)
+{
+	const vpk_entry *entry = &pool->entries[pool->next];
+
+	if (pool->next >= pool->count || entry->method != ENTRY_DEFLATE || pool->held == 0)
+		return 0;
+	return (pool->window && pool->held >= pool->window)
+		|| (pool->window_size && pool->held_size + entry->size > pool->window_size);
+}
+
+static void *compress_worker(void *arg)
+{
+	entry_pool *pool = arg;
+	vpk_entry *entry;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		if (!pool->aborted && pool->next_probe < pool->count) {
+			i = pool->next_probe++;
+			pthread_mutex_unlock(&pool->lock);
+
+			settle_entry(pool, &pool->entries[i]);
+
+			pthread_mutex_lock(&pool->lock);
+			pool->probed++;
+			pthread_cond_broadcast(&pool->cond);
+			pthread_mutex_unlock(&pool->lock);
+			continue;
+		}
+
+		// An entry still being probed elsewhere has no method yet
+		while (!pool->aborted && (pool->probed < pool->count || window_full(pool)))
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (pool->aborted || pool->next >= pool->count) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		i = pool->next++;
+		entry = &pool->entries[i];
+		if (entry->method == ENTRY_DEFLATE) {
+			entry->held = 1;
+			entry->held_size = entry->size;
+			pool->held++;
+			pool->held_size += entry->held_size;
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		if (entry->method == ENTRY_DEFLATE)
+			compress_entry(entry, pool->level);
+
+		pthread_mutex_lock(&pool->lock);
+		entry->done = 1;
+		pthread_cond_broadcast(&pool->cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+entry_pool *entry_pool_start(vpk_entry *entries, int count, int num_threads, int level,
+		int window, uint64_t window_size, uint64_t max_buffered)
+{
+	entry_pool *pool;
+
+	if (num_threads > count)
+		num_threads = count;
+
+	pool = calloc(1, sizeof(entry_pool));
+	if (!pool)
+		return NULL;
+
+	pool->entries = entries;
+	pool->count = count;
+	pool->level = level;
+	pool->window = window;
+	pool->window_size = window_size;
+	pool->max_buffered = max_buffered;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	if (num_threads > 0)
+		pool->threads = calloc(num_threads, sizeof(pthread_t));
+	if (!pool->threads)
+		return pool;
+
+	// Entries nobody picks up are compressed by the waiting thread
+	for (; pool->num_threads < num_threads; pool->num_threads++) {
+		if (pthread_create(&pool->threads[pool->num_threads], NULL, compress_worker, pool) != 0)
+			break;
+	}
+
+	return pool;
+}
+
+void entry_pool_wait_probes(entry_pool *pool)
+{
+	if (pool->num_threads == 0) {
+		for (; pool->probed < pool->count; pool->probed++)
+			settle_entry(pool, &pool->entries[pool->probed]);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->probed < pool->count)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+vpk_entry *entry_pool_wait(entry_pool *pool, int index)
+{
+	vpk_entry *entry = &pool->entries[index];
+
+	if (pool->num_threads == 0) {
+		if (!entry->done) {
+			settle_entry(pool, entry);
+			if (entry->method == ENTRY_DEFLATE)
+				compress_entry(entry, pool->level);
+			entry->done = 1;
+		}
+		return entry;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	while (!entry->done)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	return entry;
+}
+
+void entry_pool_release(entry_pool *pool, int index)
+{
+	vpk_entry *entry = &pool->entries[index];
+
+	free(entry->buf);
+	entry->buf = NULL;
+	entry->capacity = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if (entry->held) {
+		entry->held = 0;
+		pool->held--;
+		pool->held_size -= entry->held_size;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void entry_pool_finish(entry_pool *pool)
+{
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->aborted = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	for (int i = 0; i < pool->count; i++)
+		entry_pool_release(pool, i);
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->threads);
+	free(pool);
+}
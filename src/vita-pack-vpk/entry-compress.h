@@ -0,0 +1,68 @@
+#ifndef ENTRY_COMPRESS_H
+#define ENTRY_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef enum {
+	ENTRY_PROBE,		/* Decided by trial compressing the start of the file */
+	ENTRY_DEFLATE,
+	ENTRY_STREAM,		/* Too large to buffer, deflated as it is written */
+	ENTRY_STORE,
+	ENTRY_KEEP		/* Unchanged in the archive being updated */
+} entry_method;
+
+typedef struct {
+	char *src;		/* File on disk */
+	char *dst;		/* Name in the archive */
+	uint64_t size;
+	uint64_t stat_size;	/* size when scanned, size is what deflating read */
+	time_t mtime;
+	entry_method method;
+	int64_t index;		/* Archive entry it replaces, -1 if new */
+
+	/* Raw deflate stream, filled in by compress_entry() or deflate_entry() */
+	unsigned char *buf;
+	size_t comp_size;
+	size_t capacity;
+	uint32_t crc;
+
+	int status;		/* 0 on success, else an errno value */
+	int done;
+	int held;		/* Counted against the pool window until released */
+	uint64_t held_size;	/* with this much input */
+} vpk_entry;
+
+typedef struct entry_pool entry_pool;
+
+/* Receives the deflate stream chunk by chunk, returns 0 on error */
+typedef int (*entry_output)(void *arg, const unsigned char *data, size_t size);
+
+/* Settle an ENTRY_PROBE method: already compressed data (images, audio,
+ * video, archives) barely shrinks and is better stored */
+void probe_entry(vpk_entry *entry);
+/* CRC-32 of entry->src, without compressing it */
+int crc_entry(const vpk_entry *entry, uint32_t *crc);
+/* Read entry->src and deflate it into entry->buf */
+int compress_entry(vpk_entry *entry, int level);
+/* Read entry->src and deflate it into output, without buffering it */
+int deflate_entry(vpk_entry *entry, int level, entry_output output, void *arg);
+
+/* Probe, then compress the ENTRY_DEFLATE entries in order on num_threads
+ * workers. With no workers, each entry is compressed when it is first
+ * waited for. A non-zero window bounds how many deflated entries, and
+ * window_size how many bytes of their input, can be held at once. They then
+ * have to be waited for and released in order. Entries larger than a
+ * non-zero max_buffered are left to the caller as ENTRY_STREAM. */
+entry_pool *entry_pool_start(vpk_entry *entries, int count, int num_threads, int level,
+	int window, uint64_t window_size, uint64_t max_buffered);
+/* Wait until every entry has its final method */
+void entry_pool_wait_probes(entry_pool *pool);
+/* Wait for entries[index]; its output stays in entry->buf until released */
+vpk_entry *entry_pool_wait(entry_pool *pool, int index);
+/* Frees entry->buf, an entry can be released again once recompressed */
+void entry_pool_release(entry_pool *pool, int index);
+void entry_pool_finish(entry_pool *pool);
+
+#endif
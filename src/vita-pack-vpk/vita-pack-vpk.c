@@ -5,12 +5,28 @@
 #include <dirent.h>
 #include <getopt.h>
 #include <errno.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <time.h>
 #include <zip.h>
+#include <zlib.h>
+
+#include "entry-compress.h"
+#include "zip-writer.h"
 
 #define DEFAULT_OUTPUT_FILE "output.vpk"
-#ifndef PATH_MAX
-#define PATH_MAX 4096
-#endif
+/* libzip's own default level */
+#define DEFAULT_COMPRESSION_LEVEL Z_BEST_COMPRESSION
+/* Entries, and bytes of their input, each worker may compress ahead of the
+ * archive being written */
+#define ENTRIES_AHEAD_PER_THREAD 4
+#define BYTES_AHEAD_PER_THREAD (64 * 1024 * 1024)
+/* Larger files are deflated as they are written instead of ahead of time */
+#define MAX_BUFFERED_SIZE (16 * 1024 * 1024)
+#define PROGRESS_INTERVAL 1.0
+#define MIB (1024.0 * 1024.0)
+/* 1980-01-01 00:00:00 UTC, the earliest DOS timestamp */
+#define REPRODUCIBLE_MTIME 315532800
 
 static void usage(const char *arg);
 
@@ -18,54 +34,692 @@ static const struct option long_options[] = {
 	{"sfo", required_argument, NULL, 's'},
 	{"eboot", required_argument, NULL, 'b'},
 	{"add", required_argument, NULL, 'a'},
+	{"manifest", required_argument, NULL, 'm'},
+	{"jobs", required_argument, NULL, 'j'},
+	{"store", required_argument, NULL, 'S'},
+	{"update", no_argument, NULL, 'u'},
+	{"stream", no_argument, NULL, 'w'},
+	{"reproducible", no_argument, NULL, 'r'},
 	{"help", no_argument, NULL, 'h'},
 	{NULL, 0, NULL, 0}
 };
 
-static int add_file_zip(zip_t *zip, const char *src, const char *dst)
+/* Formats that are compressed already, deflating them again only costs time */
+static const char *const stored_extensions[] = {
+	"png", "jpg", "jpeg", "gif", "webp",
+	"ogg", "opus", "at3", "at9", "mp3", "m4a", "aac",
+	"mp4", "m4v", "webm", "pmf",
+	"zip", "vpk", "gz", "bz2", "xz", "7z", "rar",
+	NULL
+};
+
+static struct {
+	char **globs;
+	int num;
+} store_list;
+
+static void store_list_add(const char *glob)
+{
+	char **grown = realloc(store_list.globs, sizeof(char *) * (store_list.num + 1));
+
+	if (!grown || !(grown[store_list.num] = strdup(glob))) {
+		store_list.globs = grown ? grown : store_list.globs;
+		return;
+	}
+	store_list.globs = grown;
+	store_list.num++;
+}
+
+static void store_list_free()
+{
+	int i;
+
+	for (i = 0; i < store_list.num; i++)
+		free(store_list.globs[i]);
+	free(store_list.globs);
+}
+
+/* '*' and '?' wildcards, fnmatch() isn't available everywhere we build */
+static int match_glob(const char *glob, const char *name)
+{
+	const char *star = NULL, *resume = NULL;
+
+	while (*name) {
+		if (*glob == '*') {
+			star = glob++;
+			resume = name;
+		} else if (*glob == '?' || *glob == *name) {
+			glob++;
+			name++;
+		} else if (star) {
+			glob = star + 1;
+			name = ++resume;
+		} else {
+			return 0;
+		}
+	}
+
+	while (*glob == '*')
+		glob++;
+	return *glob == '\0';
+}
+
+static entry_method select_method(const char *dst)
+{
+	const char *base = strrchr(dst, '/');
+	const char *ext;
+	int i, j;
+
+	base = base ? base + 1 : dst;
+
+	// Globs without a '/' apply to the file name in any directory
+	for (i = 0; i < store_list.num; i++) {
+		if (match_glob(store_list.globs[i], strchr(store_list.globs[i], '/') ? dst : base))
+			return ENTRY_STORE;
+	}
+
+	ext = strrchr(base, '.');
+	if (ext) {
+		for (i = 0; stored_extensions[i]; i++) {
+			for (j = 0; stored_extensions[i][j] && tolower((unsigned char)ext[j + 1]) == stored_extensions[i][j]; j++)
+				;
+			if (stored_extensions[i][j] == '\0' && ext[j + 1] == '\0')
+				return ENTRY_STORE;
+		}
+	}
+
+	return ENTRY_PROBE;
+}
+
+static struct {
+	vpk_entry *entries;
+	int num;
+	int allocation;
+} entry_list;
+
+static int entry_list_add(const char *src, const char *dst, const struct stat *s)
+{
+	vpk_entry *entry;
+
+	if (entry_list.num == entry_list.allocation) {
+		int allocation = entry_list.allocation ? entry_list.allocation * 2 : 64;
+		entry = realloc(entry_list.entries, sizeof(vpk_entry) * allocation);
+		if (!entry)
+			return 0;
+		entry_list.entries = entry;
+		entry_list.allocation = allocation;
+	}
+
+	entry = &entry_list.entries[entry_list.num];
+	memset(entry, 0, sizeof(vpk_entry));
+	entry->src = strdup(src);
+	entry->dst = strdup(dst);
+	if (!entry->src || !entry->dst) {
+		free(entry->src);
+		free(entry->dst);
+		return 0;
+	}
+	entry->size = s->st_size;
+	entry->stat_size = s->st_size;
+	entry->mtime = s->st_mtime;
+	entry->method = select_method(dst);
+	entry->index = -1;
+
+	entry_list.num++;
+	return 1;
+}
+
+static void entry_list_free()
+{
+	int i;
+
+	for (i = 0; i < entry_list.num; i++) {
+		free(entry_list.entries[i].src);
+		free(entry_list.entries[i].dst);
+	}
+
+	free(entry_list.entries);
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+	size_t dir_len = strlen(dir), name_len = strlen(name);
+	char *path = malloc(dir_len + name_len + 2);
+
+	if (path) {
+		memcpy(path, dir, dir_len);
+		path[dir_len] = '/';
+		memcpy(path + dir_len + 1, name, name_len + 1);
+	}
+
+	return path;
+}
+
+typedef struct scan_job {
+	struct scan_job *next;
+	char *src;
+	char *dst;
+	int root; // index of the source path it was found under
+} scan_job;
+
+typedef struct {
+	scan_job *jobs;
+	int pending; // queued or being scanned
+	int *failed;
+	int stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} tree_scan;
+
+/* Queues src to be scanned as dst, taking both strings. Called with the
+ * lock held */
+static int scan_push(tree_scan *scan, char *src, char *dst, int root)
+{
+	scan_job *job = malloc(sizeof(scan_job));
+
+	if (!job || !src || !dst) {
+		fprintf(stderr, "Error: out of memory adding '%s'\n", src ? src : dst ? dst : "");
+		free(job);
+		free(src);
+		free(dst);
+		return 0;
+	}
+
+	job->src = src;
+	job->dst = dst;
+	job->root = root;
+	job->next = scan->jobs;
+	scan->jobs = job;
+	scan->pending++;
+	pthread_cond_signal(&scan->cond);
+	return 1;
+}
+
+/* Queues every directory entry, so the subdirectories of one big source
+ * directory are scanned by all threads */
+static int scan_directory(tree_scan *scan, const scan_job *job)
+{
+	DIR *dir = opendir(job->src);
+	struct dirent *entry;
+	int ret = 1;
+
+	if (!dir) {
+		fprintf(stderr, "Error: cannot open directory '%s': %s\n", job->src, strerror(errno));
+		return 0;
+	}
+
+	while(ret && (entry = readdir(dir))){
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		char *src_path = join_path(job->src, entry->d_name);
+		char *dst_path = join_path(job->dst, entry->d_name);
+		pthread_mutex_lock(&scan->lock);
+		ret = scan_push(scan, src_path, dst_path, job->root);
+		pthread_mutex_unlock(&scan->lock);
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+static int scan_entry(tree_scan *scan, const scan_job *job)
 {
 	struct stat s;
-	if (stat(src, &s)) {
-		fprintf(stderr, "Error: cannot stat '%s': %s\n", src, strerror(errno));
+	int ret;
+
+	if (stat(job->src, &s)) {
+		fprintf(stderr, "Error: cannot stat '%s': %s\n", job->src, strerror(errno));
 		return 0;
 	}
+
 	if (S_ISDIR(s.st_mode)) {
-		DIR *dir = opendir(src);
-		if (!dir) {
-			fprintf(stderr, "Error: cannot open directory '%s': %s\n", src, strerror(errno));
+		return scan_directory(scan, job);
+	}else if(S_ISREG(s.st_mode)){
+		pthread_mutex_lock(&scan->lock);
+		ret = entry_list_add(job->src, job->dst, &s);
+		pthread_mutex_unlock(&scan->lock);
+		if (!ret)
+			fprintf(stderr, "Error: out of memory adding '%s'\n", job->src);
+		return ret;
+	} else { // symlink etc.
+		fprintf(stderr, "Error: unsupported file type for '%s'\n", job->src);
+		return 0;
+	}
+}
+
+static void *scan_worker(void *arg)
+{
+	tree_scan *scan = arg;
+	scan_job *job;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&scan->lock);
+		while (!scan->jobs && scan->pending > 0 && !scan->stop)
+			pthread_cond_wait(&scan->cond, &scan->lock);
+		if (scan->stop || !scan->jobs) {
+			pthread_mutex_unlock(&scan->lock);
+			break;
+		}
+		job = scan->jobs;
+		scan->jobs = job->next;
+		pthread_mutex_unlock(&scan->lock);
+
+		ret = scan_entry(scan, job);
+
+		pthread_mutex_lock(&scan->lock);
+		scan->pending--;
+		if (!ret) {
+			scan->failed[job->root] = 1;
+			scan->stop = 1;
+		}
+		if (!ret || scan->pending == 0)
+			pthread_cond_broadcast(&scan->cond);
+		pthread_mutex_unlock(&scan->lock);
+
+		free(job->src);
+		free(job->dst);
+		free(job);
+	}
+
+	return NULL;
+}
+
+/* Lists the files under each src as dst on num_threads threads, latency
+ * dominates on network and cold filesystems. Directories are expanded by
+ * whichever thread is free, the entries are sorted afterwards. failed[i]
+ * is set if src[i] or a file under it could not be added */
+static int scan_tree(char **src, const char **dst, int count, int *failed, int num_threads)
+{
+	tree_scan scan = { .failed = failed };
+	pthread_t *threads = NULL;
+	scan_job *job;
+	int started = 0, i;
+
+	pthread_mutex_init(&scan.lock, NULL);
+	pthread_cond_init(&scan.cond, NULL);
+
+	for (i = count - 1; i >= 0; i--) {
+		failed[i] = 0;
+		if (!scan.stop && !scan_push(&scan, strdup(src[i]), strdup(dst[i]), i))
+			failed[i] = scan.stop = 1;
+	}
+
+	// The calling thread is one of them
+	if (num_threads > 1)
+		threads = calloc(num_threads - 1, sizeof(pthread_t));
+	for (; threads && started < num_threads - 1; started++) {
+		if (pthread_create(&threads[started], NULL, scan_worker, &scan) != 0)
+			break;
+	}
+
+	scan_worker(&scan);
+
+	while (started > 0)
+		pthread_join(threads[--started], NULL);
+	free(threads);
+
+	// Left over after an error
+	while ((job = scan.jobs)) {
+		scan.jobs = job->next;
+		free(job->src);
+		free(job->dst);
+		free(job);
+	}
+
+	pthread_cond_destroy(&scan.cond);
+	pthread_mutex_destroy(&scan.lock);
+	return !scan.stop;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	return strcmp(((const vpk_entry *)a)->dst, ((const vpk_entry *)b)->dst);
+}
+
+/* Replaced entries in place, then the new ones after them by name */
+static int compare_archive_order(const void *a, const void *b)
+{
+	const vpk_entry *x = a, *y = b;
+
+	if (x->index >= 0 && y->index >= 0)
+		return x->index < y->index ? -1 : x->index > y->index;
+	if (x->index >= 0 || y->index >= 0)
+		return x->index >= 0 ? -1 : 1;
+	return compare_entries(a, b);
+}
+
+/* Orders the entries by name, a name listed twice is an error */
+static int sort_entries()
+{
+	int i;
+
+	qsort(entry_list.entries, entry_list.num, sizeof(vpk_entry), compare_entries);
+	for (i = 1; i < entry_list.num; i++) {
+		if (strcmp(entry_list.entries[i - 1].dst, entry_list.entries[i].dst) == 0) {
+			fprintf(stderr, "Error: '%s' and '%s' are both added as '%s'\n",
+				entry_list.entries[i - 1].src, entry_list.entries[i].src, entry_list.entries[i].dst);
 			return 0;
 		}
-		struct dirent *entry;
-		while((entry = readdir(dir))){
-			if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-				continue;
-			char src_dir[PATH_MAX];
-			char dst_dir[PATH_MAX];
-			int src_len = snprintf(src_dir, sizeof(src_dir)-1, "%s/%s", src, entry->d_name);
-			int dst_len = snprintf(dst_dir, sizeof(dst_dir)-1, "%s/%s", dst, entry->d_name);
-			src_dir[src_len] = 0;
-			dst_dir[dst_len] = 0;
-			if (!add_file_zip(zip, src_dir, dst_dir)) {
-				closedir(dir);
+	}
+
+	return 1;
+}
+
+/* Matches the entries against the archive being updated: unchanged files are
+ * kept as they are, changed ones replace theirs and the rest is deleted */
+static int match_archive_entries(zip_t *zip)
+{
+	zip_int64_t num = zip_get_num_entries(zip, 0), index;
+	zip_stat_t st;
+	uint32_t crc;
+	char *matched;
+	int i;
+
+	matched = calloc(num > 0 ? num : 1, 1);
+	if (!matched) {
+		fprintf(stderr, "Error: out of memory\n");
+		return 0;
+	}
+
+	for (i = 0; i < entry_list.num; i++) {
+		vpk_entry *entry = &entry_list.entries[i];
+
+		index = zip_name_locate(zip, entry->dst, 0);
+		if (index < 0 || index >= num || matched[index] || zip_stat_index(zip, index, 0, &st) < 0)
+			continue;
+		matched[index] = 1;
+		entry->index = index;
+
+		if (!(st.valid & ZIP_STAT_SIZE) || st.size != entry->size)
+			continue;
+		// DOS timestamps only have a 2 second granularity
+		if ((st.valid & ZIP_STAT_MTIME) && st.mtime - entry->mtime <= 1 && entry->mtime - st.mtime <= 1)
+			entry->method = ENTRY_KEEP;
+		else if ((st.valid & ZIP_STAT_CRC) && crc_entry(entry, &crc) && crc == st.crc)
+			entry->method = ENTRY_KEEP;
+	}
+
+	for (index = 0; index < num; index++) {
+		if (!matched[index] && zip_delete(zip, index) < 0) {
+			fprintf(stderr, "Error: cannot delete '%s': %s\n", zip_get_name(zip, index, 0), zip_strerror(zip));
+			free(matched);
+			return 0;
+		}
+	}
+
+	// The compression window needs the entries in the order zip_close() writes them
+	qsort(entry_list.entries, entry_list.num, sizeof(vpk_entry), compare_archive_order);
+
+	free(matched);
+	return 1;
+}
+
+typedef struct {
+	entry_pool *pool;
+	int index;
+	size_t offset;
+	int opened;
+	int released;
+	zip_error_t error;
+} entry_source;
+
+/* libzip source handing over an entry deflated ahead of time, so zip_close()
+ * only copies it into the archive. libzip keeps every source until it is
+ * done, the buffer goes back to the pool as soon as it was read through */
+static zip_int64_t entry_source_callback(void *userdata, void *data, zip_uint64_t len, zip_source_cmd_t cmd)
+{
+	entry_source *source = userdata;
+	vpk_entry *entry;
+	zip_stat_t *st;
+
+	switch (cmd) {
+	case ZIP_SOURCE_STAT:
+		// Never waits, libzip may stat sources in any order and a full window
+		// would then block on an entry it won't read yet. The crc and size
+		// are known once opened, libzip stats again before closing for them
+		entry = &entry_list.entries[source->index];
+		st = data;
+		zip_stat_init(st);
+		st->valid = ZIP_STAT_SIZE | ZIP_STAT_COMP_METHOD | ZIP_STAT_MTIME;
+		st->size = entry->stat_size;
+		st->comp_method = ZIP_CM_DEFLATE;
+		st->mtime = entry->mtime;
+		if (source->opened) {
+			st->size = entry->size;
+			st->valid |= ZIP_STAT_COMP_SIZE | ZIP_STAT_CRC;
+			st->comp_size = entry->comp_size;
+			st->crc = entry->crc;
+		}
+		return sizeof(zip_stat_t);
+
+	case ZIP_SOURCE_OPEN:
+		entry = entry_pool_wait(source->pool, source->index);
+		if (entry->status != 0) {
+			fprintf(stderr, "Error: cannot compress '%s': %s\n", entry->src, strerror(entry->status));
+			zip_error_set(&source->error, ZIP_ER_READ, entry->status);
+			return -1;
+		}
+		// Read again after it was released
+		if (source->released && !compress_entry(entry, DEFAULT_COMPRESSION_LEVEL)) {
+			fprintf(stderr, "Error: cannot compress '%s': %s\n", entry->src, strerror(entry->status));
+			zip_error_set(&source->error, ZIP_ER_READ, entry->status);
+			return -1;
+		}
+		source->released = 0;
+		source->opened = 1;
+		source->offset = 0;
+		return 0;
+
+	case ZIP_SOURCE_READ:
+		entry = &entry_list.entries[source->index];
+		if (len > entry->comp_size - source->offset)
+			len = entry->comp_size - source->offset;
+		memcpy(data, entry->buf + source->offset, len);
+		source->offset += len;
+		return len;
+
+	case ZIP_SOURCE_CLOSE:
+		entry = &entry_list.entries[source->index];
+		if (!source->released && source->offset == entry->comp_size) {
+			entry_pool_release(source->pool, source->index);
+			source->released = 1;
+		}
+		return 0;
+
+	case ZIP_SOURCE_ERROR:
+		return zip_error_to_data(&source->error, data, len);
+
+	case ZIP_SOURCE_FREE:
+		zip_error_fini(&source->error);
+		free(source);
+		return 0;
+
+	case ZIP_SOURCE_SUPPORTS:
+		return zip_source_make_command_bitmap(ZIP_SOURCE_OPEN, ZIP_SOURCE_READ, ZIP_SOURCE_CLOSE,
+			ZIP_SOURCE_STAT, ZIP_SOURCE_ERROR, ZIP_SOURCE_FREE, -1);
+
+	default:
+		zip_error_set(&source->error, ZIP_ER_OPNOTSUPP, 0);
+		return -1;
+	}
+}
+
+/* Adds the entry, or replaces the archive entry it was matched with */
+static zip_int64_t add_entry_source(zip_t *zip, const vpk_entry *entry, zip_source_t *zs)
+{
+	zip_int64_t index = entry->index;
+
+	if (index >= 0) {
+		if (zip_file_replace(zip, index, zs, 0) < 0)
+			index = -1;
+	} else {
+		index = zip_file_add(zip, entry->dst, zs, 0);
+	}
+
+	if (index < 0) {
+		zip_source_free(zs);
+		fprintf(stderr, "Error: cannot add '%s' to zip as '%s': %s\n", entry->src, entry->dst, zip_strerror(zip));
+		return -1;
+	}
+
+	return index;
+}
+
+/* Stored entries are left to libzip to copy from the file, and those too
+ * large to buffer to deflate from it */
+static int add_file_entry_zip(zip_t *zip, const vpk_entry *entry, zip_int32_t method)
+{
+	zip_source_t *zs;
+	zip_int64_t index;
+
+	zs = zip_source_file(zip, entry->src, 0, 0);
+	if (!zs) {
+		fprintf(stderr, "Error: cannot create zip source for '%s': %s\n", entry->src, zip_strerror(zip));
+		return 0;
+	}
+	index = add_entry_source(zip, entry, zs);
+	if (index < 0)
+		return 0;
+	if (zip_set_file_compression(zip, index, method, 0) < 0) {
+		fprintf(stderr, "Error: cannot set the compression of '%s': %s\n", entry->dst, zip_strerror(zip));
+		return 0;
+	}
+
+	return 1;
+}
+
+static int add_entries_zip(zip_t *zip, entry_pool *pool)
+{
+	entry_source *source;
+	zip_source_t *zs;
+	int i;
+
+	// The method has to be set before zip_close() asks for any data
+	entry_pool_wait_probes(pool);
+
+	for (i = 0; i < entry_list.num; i++) {
+		if (entry_list.entries[i].method == ENTRY_KEEP)
+			continue;
+		if (entry_list.entries[i].method == ENTRY_STORE || entry_list.entries[i].method == ENTRY_STREAM) {
+			if (!add_file_entry_zip(zip, &entry_list.entries[i],
+					entry_list.entries[i].method == ENTRY_STORE ? ZIP_CM_STORE : ZIP_CM_DEFLATE))
 				return 0;
-			}
+			continue;
 		}
-		closedir(dir);
-	}else if(S_ISREG(s.st_mode)){
-		zip_source_t *zs = zip_source_file(zip, src, 0, 0);
+
+		source = calloc(1, sizeof(entry_source));
+		if (!source) {
+			fprintf(stderr, "Error: out of memory adding '%s'\n", entry_list.entries[i].src);
+			return 0;
+		}
+		source->pool = pool;
+		source->index = i;
+		zip_error_init(&source->error);
+
+		zs = zip_source_function(zip, entry_source_callback, source);
 		if (!zs) {
-			fprintf(stderr, "Error: cannot create zip source for '%s': %s\n", src, zip_strerror(zip));
+			fprintf(stderr, "Error: cannot create zip source for '%s': %s\n", entry_list.entries[i].src, zip_strerror(zip));
+			free(source);
 			return 0;
 		}
-		if (zip_file_add(zip, dst, zs, 0) < 0) {
-			zip_source_free(zs);
-			fprintf(stderr, "Error: cannot add '%s' to zip as '%s': %s\n", src, dst, zip_strerror(zip));
+		if (add_entry_source(zip, &entry_list.entries[i], zs) < 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+static double elapsed_seconds(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int write_to_archive(void *arg, const unsigned char *data, size_t size)
+{
+	return zip_writer_write(arg, data, size);
+}
+
+/* Deflates an entry too large to buffer straight into the archive */
+static int add_streamed_entry(zip_writer *writer, vpk_entry *entry)
+{
+	if (!zip_writer_begin_deflated(writer, entry->dst, entry->mtime, entry->size))
+		return 0;
+	if (!deflate_entry(entry, DEFAULT_COMPRESSION_LEVEL, write_to_archive, writer)) {
+		errno = entry->status;
+		return 0;
+	}
+	return zip_writer_end_deflated(writer, entry->comp_size, entry->size, entry->crc);
+}
+
+/* Writes each entry as soon as it is compressed instead of leaving it all to
+ * zip_close(), printing the throughput as it goes */
+static int write_entries_stream(const char *output, entry_pool *pool, uint64_t total_size, int flags)
+{
+	zip_writer *writer;
+	vpk_entry *entry;
+	struct timespec start;
+	double seconds, last_report = 0;
+	uint64_t done_size = 0;
+	struct stat s;
+	int i, ret;
+
+	writer = zip_writer_open(output, flags);
+	if (!writer) {
+		fprintf(stderr, "Error: cannot create '%s': %s\n", output, strerror(errno));
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < entry_list.num; i++) {
+		entry = entry_pool_wait(pool, i);
+		if (entry->status != 0) {
+			fprintf(stderr, "Error: cannot compress '%s': %s\n", entry->src, strerror(entry->status));
+			zip_writer_discard(writer);
 			return 0;
 		}
-	} else { // symlink etc.
-		fprintf(stderr, "Error: unsupported file type for '%s'\n", src);
+
+		if (entry->method == ENTRY_STORE)
+			ret = zip_writer_add_stored(writer, entry->dst, entry->mtime, entry->src, entry->size);
+		else if (entry->method == ENTRY_STREAM)
+			ret = add_streamed_entry(writer, entry);
+		else
+			ret = zip_writer_add_deflated(writer, entry->dst, entry->mtime,
+				entry->buf, entry->comp_size, entry->size, entry->crc);
+		if (!ret) {
+			fprintf(stderr, "Error: cannot write '%s' to '%s': %s\n", entry->src, output, strerror(errno));
+			zip_writer_discard(writer);
+			return 0;
+		}
+
+		done_size += entry->size;
+		entry_pool_release(pool, i);
+
+		seconds = elapsed_seconds(&start);
+		if (seconds - last_report >= PROGRESS_INTERVAL) {
+			printf("%d/%d files, %.1f/%.1f MiB, %.1f files/s, %.1f MiB/s\n",
+				i + 1, entry_list.num, done_size / MIB, total_size / MIB,
+				(i + 1) / seconds, done_size / MIB / seconds);
+			fflush(stdout);
+			last_report = seconds;
+		}
+	}
+
+	if (!zip_writer_close(writer)) {
+		fprintf(stderr, "Error: cannot write '%s': %s\n", output, strerror(errno));
 		return 0;
 	}
+
+	seconds = elapsed_seconds(&start);
+	if (seconds <= 0)
+		seconds = 1e-9;
+	printf("Packed %d files, %.1f MiB into %.1f MiB in %.2f s (%.1f files/s, %.1f MiB/s)\n",
+		entry_list.num, total_size / MIB, stat(output, &s) == 0 ? s.st_size / MIB : 0.0,
+		seconds, entry_list.num / seconds, total_size / MIB / seconds);
 	return 1;
 }
 
@@ -108,7 +762,7 @@ static void additional_list_free()
 	free(additional_list.dst);
 }
 
-static void parse_add_subopt(char *optarg)
+static int parse_add_subopt(char *optarg)
 {
 	char *src;
 	char *dst;
@@ -119,7 +773,7 @@ static void parse_add_subopt(char *optarg)
 
 	equals = strchr(optarg, '=');
 	if (!equals || (equals == optarg + len - 1))
-		return;
+		return 0;
 
 	src_len = equals - optarg;
 	dst_len = len - (equals - optarg + 1);
@@ -134,13 +788,88 @@ static void parse_add_subopt(char *optarg)
 	dst[dst_len] = '\0';
 
 	additional_list_add(src, dst);
+	return 1;
+}
+
+static char *read_line(FILE *fp)
+{
+	char *line = NULL, *grown;
+	size_t len = 0, size = 0;
+
+	for (;;) {
+		if (size - len < 2) {
+			size = size ? size * 2 : 256;
+			grown = realloc(line, size);
+			if (!grown) {
+				free(line);
+				return NULL;
+			}
+			line = grown;
+		}
+		if (!fgets(line + len, size - len, fp))
+			break;
+		len += strlen(line + len);
+		if (line[len - 1] == '\n')
+			break;
+	}
+
+	if (len == 0) {
+		free(line);
+		return NULL;
+	}
+
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+		line[--len] = '\0';
+	return line;
+}
+
+/* One src=dst pair per line like -a, blank lines and '#' comments are
+ * skipped. "-" reads from stdin */
+static int parse_manifest(const char *path)
+{
+	FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+	char *line;
+	int num = 0, ret = 1;
+
+	if (!fp) {
+		fprintf(stderr, "Error: cannot open manifest '%s': %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	while (ret && (line = read_line(fp))) {
+		num++;
+		if (line[0] != '\0' && line[0] != '#' && !parse_add_subopt(line)) {
+			fprintf(stderr, "Error: %s:%d: expected src=dst, got '%s'\n", path, num, line);
+			ret = 0;
+		}
+		free(line);
+	}
+
+	if (ret && ferror(fp)) {
+		fprintf(stderr, "Error: cannot read manifest '%s'\n", path);
+		ret = 0;
+	}
+	if (fp != stdin)
+		fclose(fp);
+	return ret;
 }
 
 int main(int argc, char *argv[])
 {
 	int i;
 	int err;
+	char **scan_paths = NULL;
+	const char **scan_dsts = NULL;
+	int *scan_failed = NULL;
+	uint64_t total_size = 0;
 	zip_t *zip;
+	entry_pool *pool = NULL;
+	int num_threads = 1;
+	int update = 0;
+	int stream = 0;
+	int reproducible = 0;
+	time_t fixed_mtime = REPRODUCIBLE_MTIME;
+	const char *source_date_epoch;
 	int opt;
 	char *output = NULL;
 	char *sfo = NULL;
@@ -153,7 +882,7 @@ int main(int argc, char *argv[])
 
 	additional_list_init();
 
-	while ((opt = getopt_long(argc, argv, "hs:b:a:", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hs:b:a:m:j:S:uwr", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 's':
 			sfo = strdup(optarg);
@@ -164,6 +893,29 @@ int main(int argc, char *argv[])
 		case 'a':
 			parse_add_subopt(optarg);
 			break;
+		case 'm':
+			if (!parse_manifest(optarg))
+				goto error_wrong_args;
+			break;
+		case 'j':
+			num_threads = strtol(optarg, NULL, 0);
+			if (num_threads < 1)
+				num_threads = 1;
+			break;
+		case 'S':
+			store_list_add(optarg);
+			break;
+		case 'u':
+			update = 1;
+			break;
+		case 'w':
+			stream = 1;
+			break;
+		case 'r':
+			// Only our own writer's output is fully determined by the input
+			reproducible = 1;
+			stream = 1;
+			break;
 		case 'h':
 			usage(argv[0]);
 			goto error_wrong_args;
@@ -180,6 +932,11 @@ int main(int argc, char *argv[])
 		goto error_wrong_args;
 	}
 
+	if (update && stream) {
+		fprintf(stderr, "Error: --update can't be combined with --stream or --reproducible\n");
+		goto error_wrong_args;
+	}
+
 	argc -= optind;
 	argv += optind;
 
@@ -188,31 +945,89 @@ int main(int argc, char *argv[])
 	else
 		output  = strdup(DEFAULT_OUTPUT_FILE);
 
-	zip = zip_open(output, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	// The sfo and eboot come first, then every -a and manifest source
+	scan_paths = malloc(sizeof(char *) * (additional_list.num + 2));
+	scan_dsts = malloc(sizeof(char *) * (additional_list.num + 2));
+	scan_failed = malloc(sizeof(int) * (additional_list.num + 2));
+	if (!scan_paths || !scan_dsts || !scan_failed) {
+		fprintf(stderr, "Error: out of memory\n");
+		goto error_create_zip;
+	}
+	scan_paths[0] = sfo;
+	scan_paths[1] = eboot;
+	memcpy(scan_paths + 2, additional_list.src, sizeof(char *) * additional_list.num);
+	scan_dsts[0] = "sce_sys/param.sfo";
+	scan_dsts[1] = "eboot.bin";
+	for (i = 0; i < additional_list.num; i++)
+		scan_dsts[i + 2] = additional_list.dst[i];
+
+	if (!scan_tree(scan_paths, scan_dsts, additional_list.num + 2, scan_failed, num_threads)) {
+		for (i = 0; !scan_failed[i]; i++)
+			;
+		if (i == 0)
+			fprintf(stderr, "Error: failed to add sfo file '%s'\n", sfo);
+		else if (i == 1)
+			fprintf(stderr, "Error: failed to add eboot file '%s'\n", eboot);
+		else
+			fprintf(stderr, "Error: failed to add additional file '%s' as '%s'\n",
+				scan_paths[i], scan_dsts[i]);
+		goto error_create_zip;
+	}
+
+	if (!sort_entries())
+		goto error_create_zip;
+
+	if (reproducible) {
+		source_date_epoch = getenv("SOURCE_DATE_EPOCH");
+		if (source_date_epoch && *source_date_epoch)
+			fixed_mtime = strtoll(source_date_epoch, NULL, 10);
+		for (i = 0; i < entry_list.num; i++)
+			entry_list.entries[i].mtime = fixed_mtime;
+	}
+
+	for (i = 0; i < entry_list.num; i++)
+		total_size += entry_list.entries[i].size;
+	printf("Packing %d files, %.1f MiB\n", entry_list.num, total_size / MIB);
+	fflush(stdout);
+
+	if (stream) {
+		pool = entry_pool_start(entry_list.entries, entry_list.num, num_threads > 1 ? num_threads : 0,
+			DEFAULT_COMPRESSION_LEVEL, num_threads * ENTRIES_AHEAD_PER_THREAD,
+			(uint64_t)num_threads * BYTES_AHEAD_PER_THREAD, MAX_BUFFERED_SIZE);
+		if (!pool) {
+			fprintf(stderr, "Error: out of memory\n");
+			goto error_create_zip;
+		}
+		if (!write_entries_stream(output, pool, total_size, reproducible ? ZIP_WRITER_UTC : 0)) {
+			entry_pool_finish(pool);
+			goto error_create_zip;
+		}
+		goto done;
+	}
+
+	zip = zip_open(output, update ? ZIP_CREATE : ZIP_CREATE | ZIP_TRUNCATE, &err);
 	if (!zip) {
 		printf("Error creating: \'%s\': %s\n", output,
 			zip_strerror(zip));
 		goto error_create_zip;
 	}
 
-	if (!add_file_zip(zip, sfo, "sce_sys/param.sfo")) {
-		fprintf(stderr, "Error: failed to add sfo file '%s'\n", sfo);
-		goto error_add_zip;
+	if (update && !match_archive_entries(zip)) {
+		zip_discard(zip);
+		goto error_create_zip;
 	}
 
-	if (!add_file_zip(zip, eboot, "eboot.bin")) {
-		fprintf(stderr, "Error: failed to add eboot file '%s'\n", eboot);
+	// Entries are deflated on the workers while zip_close() writes them out in order
+	pool = entry_pool_start(entry_list.entries, entry_list.num, num_threads > 1 ? num_threads : 0,
+		DEFAULT_COMPRESSION_LEVEL, num_threads * ENTRIES_AHEAD_PER_THREAD,
+		(uint64_t)num_threads * BYTES_AHEAD_PER_THREAD, MAX_BUFFERED_SIZE);
+	if (!pool) {
+		fprintf(stderr, "Error: out of memory\n");
 		goto error_add_zip;
 	}
 
-	for (i = 0; i < additional_list.num; i++) {
-		if (!add_file_zip(zip, additional_list.src[i],
-				  additional_list.dst[i])) {
-			fprintf(stderr, "Error: failed to add additional file '%s' as '%s'\n",
-				additional_list.src[i], additional_list.dst[i]);
-			goto error_add_zip;
-		}
-	}
+	if (!add_entries_zip(zip, pool))
+		goto error_add_zip;
 
 	err = zip_close(zip);
 	if (err == -1) {
@@ -221,18 +1036,30 @@ int main(int argc, char *argv[])
 		goto error_add_zip;
 	}
 
+done:
+	entry_pool_finish(pool);
+	free(scan_paths);
+	free(scan_dsts);
+	free(scan_failed);
 	free(output);
 	free(sfo);
 	free(eboot);
 	additional_list_free();
+	store_list_free();
+	entry_list_free();
 
 	return 0;
 
 error_add_zip:
 	zip_discard(zip);
+	entry_pool_finish(pool);
 
 error_create_zip:
+	free(scan_paths);
+	free(scan_dsts);
+	free(scan_failed);
 	free(output);
+	entry_list_free();
 
 error_wrong_args:
 	if (sfo)
@@ -241,6 +1068,7 @@ error_wrong_args:
 		free(eboot);
 
 	additional_list_free();
+	store_list_free();
 
 	return -1;
 }
@@ -251,6 +1079,18 @@ void usage(const char *arg)
 		"  -s, --sfo=param.sfo     sets the param.sfo file\n"
 		"  -b, --eboot=eboot.bin   sets the eboot.bin file\n"
 		"  -a, --add src=dst       adds the file or directory src to the vpk as dst\n"
+		"  -m, --manifest=FILE     adds the src=dst pairs listed in FILE, one per line,\n"
+		"                          - reads them from stdin\n"
+		"  -j, --jobs=N            scans and compresses files on N threads (default 1)\n"
+		"  -u, --update            only rewrites the entries of an existing output.vpk\n"
+		"                          whose file changed\n"
+		"  -w, --stream            writes each file as soon as it is compressed with\n"
+		"                          bounded memory, reporting progress\n"
+		"  -r, --reproducible      writes a byte for byte reproducible vpk: sorted\n"
+		"                          entries, fixed attributes and every mtime set to\n"
+		"                          $SOURCE_DATE_EPOCH, or 1980-01-01. Implies --stream\n"
+		"  -S, --store=GLOB        stores matching files uncompressed, a GLOB without\n"
+		"                          '/' matches file names in any directory\n"
 		"  -h, --help              displays this help and exit\n"
 		, arg);
 }
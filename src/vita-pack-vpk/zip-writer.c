@@ -0,0 +1,424 @@
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "zip-writer.h"
+
+#ifdef __MINGW32__
+#define fseeko fseeko64
+#endif
+
+#define LOCAL_HEADER_SIGNATURE 0x04034b50
+#define CENTRAL_HEADER_SIGNATURE 0x02014b50
+#define END_OF_CENTRAL_DIRECTORY_SIGNATURE 0x06054b50
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE 0x06064b50
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP64_EXTRA_ID 0x0001
+
+#define LOCAL_HEADER_SIZE 30
+#define CENTRAL_HEADER_SIZE 46
+#define END_OF_CENTRAL_DIRECTORY_SIZE 22
+#define ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE 56
+#define ZIP64_LOCATOR_SIZE 20
+/* Header id, size and up to three 64-bit fields */
+#define ZIP64_EXTRA_MAX_SIZE 28
+
+/* All ones in a 32 or 16-bit field means the value is in the ZIP64 extra */
+#define ZIP64_LIMIT 0xffffffffu
+#define ZIP64_COUNT_LIMIT 0xffff
+
+#define METHOD_STORE 0
+#define METHOD_DEFLATE 8
+#define FLAG_UTF8 0x0800
+#define VERSION_NEEDED 20
+#define VERSION_NEEDED_ZIP64 45
+/* Unix, spec version 6.3 and rw-rw-rw- regular files, as libzip does */
+#define VERSION_MADE_BY 0x033f
+#define EXTERNAL_ATTRIBUTES (0100666u << 16)
+
+#define COPY_CHUNK_SIZE (256 * 1024)
+
+typedef struct {
+	char *name;
+	uint16_t version_needed;
+	uint16_t flags;
+	uint16_t method;
+	uint32_t dostime;
+	uint32_t crc;
+	uint64_t comp_size;
+	uint64_t size;
+	uint64_t offset;
+	int local_zip64;
+} central_entry;
+
+struct zip_writer {
+	FILE *fp;
+	char *path;
+	int flags;
+	uint64_t offset;
+
+	central_entry *entries;
+	int num;
+	int allocation;
+};
+
+static void put16(unsigned char *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+	put32(p, v);
+	put32(p + 4, v >> 32);
+}
+
+static uint32_t dos_time(time_t t, int utc)
+{
+	struct tm *tm = utc ? gmtime(&t) : localtime(&t);
+
+	// DOS dates start in 1980
+	if (!tm || tm->tm_year < 80)
+		return (1 << 21) | (1 << 16);
+
+	return ((uint32_t)(tm->tm_year - 80) << 25) | ((tm->tm_mon + 1) << 21) | (tm->tm_mday << 16)
+		| (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec >> 1);
+}
+
+static int write_data(zip_writer *writer, const void *data, size_t size)
+{
+	if (size > 0 && fwrite(data, size, 1, writer->fp) != 1)
+		return 0;
+	writer->offset += size;
+	return 1;
+}
+
+/* Records the entry and writes its local header. The sizes are known up
+ * front, so a ZIP64 extra is only added when they need one */
+static central_entry *begin_entry(zip_writer *writer, const char *name, time_t mtime,
+		uint16_t method, uint32_t crc, uint64_t comp_size, uint64_t size)
+{
+	unsigned char header[LOCAL_HEADER_SIZE];
+	unsigned char extra[ZIP64_EXTRA_MAX_SIZE];
+	central_entry *entry;
+	size_t name_len = strlen(name);
+	int zip64 = size >= ZIP64_LIMIT || comp_size >= ZIP64_LIMIT;
+
+	if (name_len > UINT16_MAX) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	if (writer->num == writer->allocation) {
+		int allocation = writer->allocation ? writer->allocation * 2 : 64;
+		entry = realloc(writer->entries, sizeof(central_entry) * allocation);
+		if (!entry)
+			return NULL;
+		writer->entries = entry;
+		writer->allocation = allocation;
+	}
+
+	entry = &writer->entries[writer->num];
+	entry->name = strdup(name);
+	if (!entry->name)
+		return NULL;
+	entry->flags = 0;
+	for (size_t i = 0; i < name_len; i++) {
+		if ((unsigned char)name[i] >= 0x80)
+			entry->flags = FLAG_UTF8;
+	}
+	entry->version_needed = zip64 || writer->offset >= ZIP64_LIMIT ? VERSION_NEEDED_ZIP64 : VERSION_NEEDED;
+	entry->method = method;
+	entry->dostime = dos_time(mtime, writer->flags & ZIP_WRITER_UTC);
+	entry->crc = crc;
+	entry->comp_size = comp_size;
+	entry->size = size;
+	entry->offset = writer->offset;
+	entry->local_zip64 = zip64;
+	writer->num++;
+
+	// The local ZIP64 extra always has both sizes
+	if (zip64) {
+		put16(extra, ZIP64_EXTRA_ID);
+		put16(extra + 2, 16);
+		put64(extra + 4, size);
+		put64(extra + 12, comp_size);
+	}
+
+	put32(header, LOCAL_HEADER_SIGNATURE);
+	put16(header + 4, entry->version_needed);
+	put16(header + 6, entry->flags);
+	put16(header + 8, method);
+	put32(header + 10, entry->dostime);
+	put32(header + 14, crc);
+	put32(header + 18, zip64 ? ZIP64_LIMIT : comp_size);
+	put32(header + 22, zip64 ? ZIP64_LIMIT : size);
+	put16(header + 26, name_len);
+	put16(header + 28, zip64 ? 20 : 0);
+
+	if (!write_data(writer, header, sizeof(header)) || !write_data(writer, name, name_len)
+			|| (zip64 && !write_data(writer, extra, 20)))
+		return NULL;
+
+	return entry;
+}
+
+zip_writer *zip_writer_open(const char *path, int flags)
+{
+	zip_writer *writer = calloc(1, sizeof(zip_writer));
+
+	if (!writer)
+		return NULL;
+
+	writer->flags = flags;
+	writer->path = strdup(path);
+	writer->fp = writer->path ? fopen(path, "wb") : NULL;
+	if (!writer->fp) {
+		free(writer->path);
+		free(writer);
+		return NULL;
+	}
+
+	return writer;
+}
+
+int zip_writer_add_deflated(zip_writer *writer, const char *name, time_t mtime,
+		const unsigned char *data, size_t comp_size, uint64_t size, uint32_t crc)
+{
+	if (!begin_entry(writer, name, mtime, METHOD_DEFLATE, crc, comp_size, size))
+		return 0;
+	return write_data(writer, data, comp_size);
+}
+
+int zip_writer_begin_deflated(zip_writer *writer, const char *name, time_t mtime, uint64_t size)
+{
+	// Deflate grows incompressible input by well under 1/2048, so the
+	// sizes only get a ZIP64 extra when the data might overflow
+	uint64_t bound = size + (size >> 11) + 64;
+
+	return begin_entry(writer, name, mtime, METHOD_DEFLATE, 0, bound, size) != NULL;
+}
+
+int zip_writer_write(zip_writer *writer, const void *data, size_t size)
+{
+	return write_data(writer, data, size);
+}
+
+int zip_writer_end_deflated(zip_writer *writer, uint64_t comp_size, uint64_t size, uint32_t crc)
+{
+	central_entry *entry = &writer->entries[writer->num - 1];
+	unsigned char fields[16];
+
+	if (!entry->local_zip64 && (size >= ZIP64_LIMIT || comp_size >= ZIP64_LIMIT)) {
+		// The file grew past what it was stat'ed at
+		errno = EAGAIN;
+		return 0;
+	}
+	entry->crc = crc;
+	entry->comp_size = comp_size;
+	entry->size = size;
+
+	// The CRC and sizes in the local header, or the sizes in its ZIP64 extra
+	put32(fields, crc);
+	put32(fields + 4, entry->local_zip64 ? ZIP64_LIMIT : comp_size);
+	put32(fields + 8, entry->local_zip64 ? ZIP64_LIMIT : size);
+	if (fseeko(writer->fp, entry->offset + 14, SEEK_SET) != 0
+			|| fwrite(fields, 12, 1, writer->fp) != 1)
+		return 0;
+	if (entry->local_zip64) {
+		put64(fields, size);
+		put64(fields + 8, comp_size);
+		if (fseeko(writer->fp, entry->offset + LOCAL_HEADER_SIZE + strlen(entry->name) + 4, SEEK_SET) != 0
+				|| fwrite(fields, 16, 1, writer->fp) != 1)
+			return 0;
+	}
+
+	return fseeko(writer->fp, 0, SEEK_END) == 0;
+}
+
+int zip_writer_add_stored(zip_writer *writer, const char *name, time_t mtime,
+		const char *path, uint64_t size)
+{
+	central_entry *entry;
+	unsigned char *chunk;
+	unsigned char crc[4];
+	uint64_t copied = 0;
+	size_t read;
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return 0;
+	chunk = malloc(COPY_CHUNK_SIZE);
+	if (!chunk)
+		goto out;
+
+	// The CRC is only known after the copy, it's patched into the header
+	entry = begin_entry(writer, name, mtime, METHOD_STORE, 0, size, size);
+	if (!entry)
+		goto out;
+
+	while ((read = fread(chunk, 1, COPY_CHUNK_SIZE, fp)) > 0) {
+		if (copied + read > size)
+			break;
+		entry->crc = crc32(entry->crc, chunk, read);
+		if (!write_data(writer, chunk, read))
+			goto out;
+		copied += read;
+	}
+	if (ferror(fp))
+		goto out;
+	if (copied != size || read > 0) {
+		// The file changed since it was stat'ed
+		errno = EAGAIN;
+		goto out;
+	}
+
+	put32(crc, entry->crc);
+	if (fseeko(writer->fp, entry->offset + 14, SEEK_SET) != 0
+			|| fwrite(crc, sizeof(crc), 1, writer->fp) != 1
+			|| fseeko(writer->fp, 0, SEEK_END) != 0)
+		goto out;
+
+	ret = 1;
+out:
+	free(chunk);
+	fclose(fp);
+	return ret;
+}
+
+/* The ZIP64 end of central directory record and its locator */
+static int write_zip64_end(zip_writer *writer, uint64_t directory_offset, uint64_t directory_size)
+{
+	unsigned char end[ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE + ZIP64_LOCATOR_SIZE];
+	unsigned char *locator = end + ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE;
+
+	put32(end, ZIP64_END_OF_CENTRAL_DIRECTORY_SIGNATURE);
+	put64(end + 4, ZIP64_END_OF_CENTRAL_DIRECTORY_SIZE - 12);
+	put16(end + 12, VERSION_MADE_BY);
+	put16(end + 14, VERSION_NEEDED_ZIP64);
+	put32(end + 16, 0);
+	put32(end + 20, 0);
+	put64(end + 24, writer->num);
+	put64(end + 32, writer->num);
+	put64(end + 40, directory_size);
+	put64(end + 48, directory_offset);
+
+	put32(locator, ZIP64_LOCATOR_SIGNATURE);
+	put32(locator + 4, 0);
+	put64(locator + 8, writer->offset);
+	put32(locator + 16, 1);
+
+	return write_data(writer, end, sizeof(end));
+}
+
+int zip_writer_close(zip_writer *writer)
+{
+	unsigned char header[CENTRAL_HEADER_SIZE];
+	unsigned char extra[ZIP64_EXTRA_MAX_SIZE];
+	unsigned char end[END_OF_CENTRAL_DIRECTORY_SIZE];
+	uint64_t directory_offset = writer->offset, directory_size;
+	int zip64, ret = 1;
+
+	for (int i = 0; i < writer->num && ret; i++) {
+		central_entry *entry = &writer->entries[i];
+		size_t name_len = strlen(entry->name);
+		size_t extra_len = 4;
+
+		// Only the fields that overflow go into the central ZIP64 extra
+		if (entry->size >= ZIP64_LIMIT) {
+			put64(extra + extra_len, entry->size);
+			extra_len += 8;
+		}
+		if (entry->comp_size >= ZIP64_LIMIT) {
+			put64(extra + extra_len, entry->comp_size);
+			extra_len += 8;
+		}
+		if (entry->offset >= ZIP64_LIMIT) {
+			put64(extra + extra_len, entry->offset);
+			extra_len += 8;
+		}
+		put16(extra, ZIP64_EXTRA_ID);
+		put16(extra + 2, extra_len - 4);
+		if (extra_len == 4)
+			extra_len = 0;
+
+		put32(header, CENTRAL_HEADER_SIGNATURE);
+		put16(header + 4, VERSION_MADE_BY);
+		put16(header + 6, entry->version_needed);
+		put16(header + 8, entry->flags);
+		put16(header + 10, entry->method);
+		put32(header + 12, entry->dostime);
+		put32(header + 16, entry->crc);
+		put32(header + 20, entry->comp_size >= ZIP64_LIMIT ? ZIP64_LIMIT : entry->comp_size);
+		put32(header + 24, entry->size >= ZIP64_LIMIT ? ZIP64_LIMIT : entry->size);
+		put16(header + 28, name_len);
+		put16(header + 30, extra_len);
+		put16(header + 32, 0);
+		put16(header + 34, 0);
+		put16(header + 36, 0);
+		put32(header + 38, EXTERNAL_ATTRIBUTES);
+		put32(header + 42, entry->offset >= ZIP64_LIMIT ? ZIP64_LIMIT : entry->offset);
+
+		ret = write_data(writer, header, sizeof(header)) && write_data(writer, entry->name, name_len)
+			&& write_data(writer, extra, extra_len);
+	}
+
+	directory_size = writer->offset - directory_offset;
+	zip64 = writer->num >= ZIP64_COUNT_LIMIT || directory_size >= ZIP64_LIMIT
+		|| directory_offset >= ZIP64_LIMIT;
+
+	if (ret && zip64)
+		ret = write_zip64_end(writer, directory_offset, directory_size);
+
+	if (ret) {
+		put32(end, END_OF_CENTRAL_DIRECTORY_SIGNATURE);
+		put16(end + 4, 0);
+		put16(end + 6, 0);
+		put16(end + 8, zip64 ? ZIP64_COUNT_LIMIT : writer->num);
+		put16(end + 10, zip64 ? ZIP64_COUNT_LIMIT : writer->num);
+		put32(end + 12, zip64 ? ZIP64_LIMIT : directory_size);
+		put32(end + 16, zip64 ? ZIP64_LIMIT : directory_offset);
+		put16(end + 20, 0);
+		ret = write_data(writer, end, sizeof(end));
+	}
+
+	if (fclose(writer->fp) != 0)
+		ret = 0;
+	writer->fp = NULL;
+
+	if (!ret) {
+		int err = errno;
+		remove(writer->path);
+		errno = err;
+	}
+
+	zip_writer_discard(writer);
+	return ret;
+}
+
+void zip_writer_discard(zip_writer *writer)
+{
+	if (writer->fp) {
+		fclose(writer->fp);
+		remove(writer->path);
+	}
+
+	for (int i = 0; i < writer->num; i++)
+		free(writer->entries[i].name);
+	free(writer->entries);
+	free(writer->path);
+	free(writer);
+}
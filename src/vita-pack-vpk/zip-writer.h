@@ -0,0 +1,32 @@
+#ifndef ZIP_WRITER_H
+#define ZIP_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Writes an archive front to back, each entry's local header and data
+ * as it is added and the central directory on close. ZIP64 records are
+ * only used where sizes, offsets or the entry count need them. */
+typedef struct zip_writer zip_writer;
+
+/* DOS timestamps in UTC rather than local time */
+#define ZIP_WRITER_UTC 1
+
+zip_writer *zip_writer_open(const char *path, int flags);
+/* data is a raw deflate stream of size bytes of input */
+int zip_writer_add_deflated(zip_writer *writer, const char *name, time_t mtime,
+	const unsigned char *data, size_t comp_size, uint64_t size, uint32_t crc);
+/* Starts a deflated entry of about size bytes of input whose data is then
+ * written as it comes, its sizes and CRC are patched in once it is done */
+int zip_writer_begin_deflated(zip_writer *writer, const char *name, time_t mtime, uint64_t size);
+int zip_writer_write(zip_writer *writer, const void *data, size_t size);
+int zip_writer_end_deflated(zip_writer *writer, uint64_t comp_size, uint64_t size, uint32_t crc);
+/* Copies size bytes from path uncompressed */
+int zip_writer_add_stored(zip_writer *writer, const char *name, time_t mtime,
+	const char *path, uint64_t size);
+int zip_writer_close(zip_writer *writer);
+/* Closes and removes the incomplete archive */
+void zip_writer_discard(zip_writer *writer);
+
+#endif
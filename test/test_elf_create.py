@@ -117,6 +117,54 @@ def main():
         assert found_movw, "Regression (#225): MOVW relocation against scePowerIsPowerOnline missing from .sce.rel"
         assert found_movt, "Regression (#225): MOVT relocation against scePowerIsPowerOnline missing from .sce.rel"
 
+        # Test 4: Stripped output (-s) keeps the segments, packed right after the headers
+        velf4 = os.path.join(tmpdir, "sample_stripped.velf")
+        res4 = subprocess.run([elf_create, "-s", sample_elf, velf4], capture_output=True, text=True)
+        if res4.returncode != 0:
+            print("Failed vita-elf-create -s on sample.elf:", res4.stderr)
+            sys.exit(1)
+
+        with open(velf1, 'rb') as f:
+            full = f.read()
+        with open(velf4, 'rb') as f:
+            stripped = f.read()
+        e_phoff, e_shoff = struct.unpack_from('<II', stripped, 28)
+        e_ehsize, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx = struct.unpack_from('<HHHHHH', stripped, 40)
+        assert e_shoff == 0 and e_shnum == 0 and e_shstrndx == 0, "Stripped VELF still has section headers"
+        assert e_phoff == e_ehsize, "Stripped VELF program headers do not follow the ELF header"
+        full_phoff = struct.unpack_from('<I', full, 28)[0]
+        for i in range(e_phnum):
+            p_offset, p_vaddr, p_paddr, p_filesz = struct.unpack_from('<IIII', stripped, e_phoff + 4 + i * e_phentsize)
+            full_offset = struct.unpack_from('<I', full, full_phoff + 4 + i * e_phentsize)[0]
+            assert stripped[p_offset:p_offset+p_filesz] == full[full_offset:full_offset+p_filesz], \
+                "Segment %d differs between stripped and full VELF" % i
+
+        # Test 5: NID cache ($VITA_NID_CACHE) gives the same exports cold, warm and when verifying
+        nid_cache = os.path.join(tmpdir, "nids.cache")
+        cache_env = dict(os.environ, VITA_NID_CACHE=nid_cache)
+        exports = []
+        for run, env in enumerate([os.environ, cache_env, cache_env, dict(cache_env, VITA_NID_CACHE_VERIFY="1")]):
+            exports_yml = os.path.join(tmpdir, "exports%d.yml" % run)
+            res5 = subprocess.run([elf_create, "-g", exports_yml, sample_elf, os.path.join(tmpdir, "cached.velf")],
+                                  capture_output=True, text=True, env=env)
+            if res5.returncode != 0:
+                print("Failed vita-elf-create -g with NID cache:", res5.stderr)
+                sys.exit(1)
+            with open(exports_yml) as f:
+                exports.append(f.read())
+        assert os.path.getsize(nid_cache) > 12, "NID cache was not populated"
+        assert all(e == exports[0] for e in exports), "Cached export NIDs differ from computed ones"
+
+        # A stale entry is used as is, but verify mode reports it
+        with open(nid_cache, "r+b") as f:
+            f.seek(12)
+            nid = f.read(1)
+            f.seek(12)
+            f.write(bytes([nid[0] ^ 0xff]))
+        res5v = subprocess.run([elf_create, "-g", os.path.join(tmpdir, "stale.yml"), sample_elf, os.path.join(tmpdir, "stale.velf")],
+                               capture_output=True, text=True, env=dict(cache_env, VITA_NID_CACHE_VERIFY="1"))
+        assert res5v.returncode != 0, "Verify mode accepted a stale NID cache entry"
+
     print("test_elf_create: ALL TESTS PASSED")
 
 if __name__ == "__main__":
@@ -1,6 +1,8 @@
 #!/usr/bin/env python3
 import sys
 import os
+import struct
+import shutil
 import subprocess
 import tempfile
 
@@ -19,6 +21,15 @@ modules:
           SceKernelStackGuard: 0x3E5A5A5A
 """
 
+YAML_OTHER_MODULE = """  SceOther:
+    nid: 0x11111111
+    libraries:
+      SceOther:
+        nid: 0x11111111
+        functions:
+          sceOtherFunction: 0x22222222
+"""
+
 YAML_WITHOUT_FIRMWARE = """
 version: 2
 modules:
@@ -56,6 +67,100 @@ def main():
         files1 = os.listdir(out1_dir)
         assert len(files1) > 0, "No output files generated from YAML with firmware"
         
+        # Reruns only rewrite libraries whose database content changed
+        for name in files1:
+            os.utime(os.path.join(out1_dir, name), (1000000000, 1000000000))
+        res_inc = subprocess.run([libs_gen, f"-yml={yml1_path}", f"-output={out1_dir}"], capture_output=True, text=True)
+        assert res_inc.returncode == 0, res_inc.stderr
+        for name in os.listdir(out1_dir):
+            assert os.stat(os.path.join(out1_dir, name)).st_mtime == 1000000000, f"{name} was rewritten"
+
+        # -j spreads stubs over threads without changing any output
+        outj_dir = os.path.join(tmpdir, "outj")
+        os.makedirs(outj_dir, exist_ok=True)
+        resj = subprocess.run([libs_gen, f"-yml={yml1_path}", f"-output={outj_dir}", "-j=4"],
+                              capture_output=True, text=True)
+        if resj.returncode != 0:
+            print("Failed libs-gen-2 with -j=4:", resj.stderr)
+            sys.exit(1)
+        assert sorted(os.listdir(outj_dir)) == sorted(files1)
+        for name in files1:
+            with open(os.path.join(out1_dir, name), "rb") as f1, open(os.path.join(outj_dir, name), "rb") as f2:
+                assert f1.read() == f2.read(), name
+
+        # Building with the makefile keeps the .S files, so after a rerun make
+        # only rebuilds the archives of changed libraries
+        if shutil.which("make") and shutil.which("ar") and shutil.which("ranlib"):
+            make_dir = os.path.join(tmpdir, "outmake")
+            os.makedirs(make_dir, exist_ok=True)
+            yml_make_path = os.path.join(tmpdir, "make.yml")
+            with open(yml_make_path, "w") as f:
+                f.write(YAML_WITH_FIRMWARE + YAML_OTHER_MODULE)
+            # Stands in for arm-vita-eabi-as: "--defsym X=N in.S -o out.o"
+            fake_as = os.path.join(tmpdir, "fake_as.py")
+            with open(fake_as, "w") as f:
+                f.write("import shutil, sys\nshutil.copyfile(sys.argv[3], sys.argv[5])\n")
+            make_cmd = ["make", "-C", make_dir, f"AS={sys.executable} {fake_as}", "AR=ar", "RANLIB=ranlib"]
+
+            def gen_and_make():
+                res = subprocess.run([libs_gen, f"-yml={yml_make_path}", f"-output={make_dir}"],
+                                     capture_output=True, text=True)
+                assert res.returncode == 0, res.stderr
+                res = subprocess.run(make_cmd, capture_output=True, text=True)
+                assert res.returncode == 0, res.stdout + res.stderr
+
+            gen_and_make()
+            archives = [n for n in os.listdir(make_dir) if n.endswith(".a")]
+            assert sorted(archives) == ["libSceLibKernel_stub.a", "libSceLibKernel_stub_weak.a",
+                                        "libSceOther_stub.a", "libSceOther_stub_weak.a"], archives
+            assert any(n.endswith(".S") for n in os.listdir(make_dir)), "make deleted the .S files"
+
+            for name in os.listdir(make_dir):
+                os.utime(os.path.join(make_dir, name), (1000000000, 1000000000))
+            gen_and_make()
+            for name in archives:
+                assert os.stat(os.path.join(make_dir, name)).st_mtime == 1000000000, f"{name} was rebuilt"
+
+            with open(yml_make_path, "w") as f:
+                f.write(YAML_WITH_FIRMWARE.replace("0x25A118A4", "0x25A118A5") + YAML_OTHER_MODULE)
+            gen_and_make()
+            for name in archives:
+                rebuilt = os.stat(os.path.join(make_dir, name)).st_mtime != 1000000000
+                assert rebuilt == name.startswith("libSceLibKernel"), name
+
+        # Archive mode writes lib*_stub.a directly, no assembler needed
+        out3_dir = os.path.join(tmpdir, "out3")
+        os.makedirs(out3_dir, exist_ok=True)
+        res3 = subprocess.run([libs_gen, f"-yml={yml1_path}", f"-output={out3_dir}", "-archive=true"],
+                              capture_output=True, text=True)
+        if res3.returncode != 0:
+            print("Failed libs-gen-2 in archive mode:", res3.stderr)
+            sys.exit(1)
+        for name in ("libSceLibKernel_stub.a", "libSceLibKernel_stub_weak.a"):
+            with open(os.path.join(out3_dir, name), "rb") as f:
+                data = f.read()
+            assert data.startswith(b"!<arch>\n"), name
+            assert b"sceKernelGetThreadId" in data and b"SceKernelStackGuard" in data, name
+            # Stub record after the attributes word: library NID, function NID, NOP
+            assert struct.pack("<III", 0xCA94D18E, 0x25A118A4, 0xE320F000) in data, name
+            # $d and $a mapping symbols mark the record as data and the NOP as code, as gas does
+            assert b"\0$d\0$a\0sceKernelGetThreadId\0" in data, name
+            assert b"\0$d\0SceKernelStackGuard\0" in data, name
+        assert "makefile" in os.listdir(out3_dir)
+        assert not any(f.endswith(".S") for f in os.listdir(out3_dir))
+
+        # A changed NID rewrites its library's archives, nothing else
+        for name in os.listdir(out3_dir):
+            os.utime(os.path.join(out3_dir, name), (1000000000, 1000000000))
+        with open(yml1_path, "w") as f:
+            f.write(YAML_WITH_FIRMWARE.replace("0x25A118A4", "0x25A118A5"))
+        res_inc = subprocess.run([libs_gen, f"-yml={yml1_path}", f"-output={out3_dir}", "-archive=true"],
+                                 capture_output=True, text=True)
+        assert res_inc.returncode == 0, res_inc.stderr
+        with open(os.path.join(out3_dir, "libSceLibKernel_stub.a"), "rb") as f:
+            assert struct.pack("<II", 0xCA94D18E, 0x25A118A5) in f.read()
+        assert os.stat(os.path.join(out3_dir, "makefile")).st_mtime == 1000000000
+
         # Test 2: YAML without firmware (Issue #244 regression test)
         yml2_path = os.path.join(tmpdir, "nofw.yml")
         with open(yml2_path, "w") as f:
@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 import sys
 import os
+import hashlib
 import struct
 import subprocess
 import tempfile
@@ -40,7 +41,44 @@ def main():
         with open(fself_c_path, "rb") as f:
             fself_c_data = f.read()
         assert fself_c_data[:4] == b'SCE\0'
-        
+
+        # Parallel compression (-j) must produce the same bytes as the serial path
+        fself_j_path = os.path.join(tmpdir, "eboot_j.bin")
+        res2j = subprocess.run([make_fself, "-c", "-j", "4", sample_velf, fself_j_path], capture_output=True, text=True)
+        if res2j.returncode != 0:
+            print("Failed vita-make-fself with parallel compression:", res2j.stderr)
+            sys.exit(1)
+
+        with open(fself_j_path, "rb") as f:
+            assert f.read() == fself_c_data, "Parallel compression output differs from serial output"
+
+        # Fast compression level with the per-segment report
+        fself_fast_path = os.path.join(tmpdir, "eboot_fast.bin")
+        res2f = subprocess.run([make_fself, "-c=1", "-v", sample_velf, fself_fast_path], capture_output=True, text=True)
+        if res2f.returncode != 0:
+            print("Failed vita-make-fself with -c=1:", res2f.stderr)
+            sys.exit(1)
+        assert "segment 0:" in res2f.stdout, "Missing per-segment compression report"
+
+        # The ELF digest covers the input as given, with only the module NID
+        # written in, even when phdrs follow module_info and need p_align clamped
+        align_velf = os.path.join(fixtures_dir, "sample_align.velf")
+        fself_align_path = os.path.join(tmpdir, "eboot_align.bin")
+        res_a = subprocess.run([make_fself, align_velf, fself_align_path], capture_output=True, text=True)
+        if res_a.returncode != 0:
+            print("Failed vita-make-fself on sample_align.velf:", res_a.stderr)
+            sys.exit(1)
+        with open(align_velf, "rb") as f:
+            velf = bytearray(f.read())
+        e_entry, e_phoff = struct.unpack_from("<II", velf, 0x18)
+        p_offset = struct.unpack_from("<I", velf, e_phoff + 4)[0]
+        assert struct.unpack_from("<I", velf, e_phoff + 28)[0] == 0x4000
+        nid = int.from_bytes(hashlib.sha256(hashlib.sha256(velf).digest()).digest()[:4], "big")
+        struct.pack_into("<I", velf, p_offset + (e_entry & 0x3fffffff) + 0x34, nid)
+        with open(fself_align_path, "rb") as f:
+            fself_align_data = f.read()
+        assert hashlib.sha256(velf).digest() in fself_align_data, "ELF digest differs from the input's"
+
         # Test 3: Relocation converter with psp2rela
         fself_rela_out = os.path.join(tmpdir, "eboot_rela.bin")
         res3 = subprocess.run([psp2rela, f"-src={fself_path}", f"-dst={fself_rela_out}"], capture_output=True, text=True)
@@ -57,7 +57,155 @@ def main():
             assert z.read("eboot.bin") == b"MOCK_EBOOT_DATA"
             assert z.read("sce_sys/param.sfo") == b"MOCK_SFO_DATA"
             assert z.read("assets/config.txt") == b"CONFIG_DATA"
-            
+
+        # Parallel compression (-j) must produce the same archive
+        vpk_j_path = os.path.join(tmpdir, "test_j.vpk")
+        res_j = subprocess.run(cmd[:-1] + ["-j", "4", vpk_j_path], capture_output=True, text=True)
+        if res_j.returncode != 0:
+            print("Failed to run vita-pack-vpk -j 4:", res_j.stderr)
+            sys.exit(1)
+        with open(vpk_path, "rb") as f1, open(vpk_j_path, "rb") as f2:
+            assert f1.read() == f2.read(), "Parallel packing output differs from serial output"
+
+        # The streaming writer packs the same entries and reports a summary
+        vpk_w_path = os.path.join(tmpdir, "test_w.vpk")
+        res_w = subprocess.run(cmd[:-1] + ["-w", "-j", "2", vpk_w_path], capture_output=True, text=True)
+        if res_w.returncode != 0:
+            print("Failed to run vita-pack-vpk -w:", res_w.stderr)
+            sys.exit(1)
+        assert "Packed 4 files" in res_w.stdout, res_w.stdout
+        with zipfile.ZipFile(vpk_path, "r") as z1, zipfile.ZipFile(vpk_w_path, "r") as z2:
+            assert z2.testzip() is None
+            assert z1.namelist() == z2.namelist()
+            for name in z1.namelist():
+                assert z1.read(name) == z2.read(name), name
+
+        # A manifest on stdin packs the same archive as the -a list
+        vpk_m_path = os.path.join(tmpdir, "test_m.vpk")
+        manifest = f"# comment\n{extra_dir}=assets\n\n{asset_path}=sce_sys/icon0.png\n"
+        res_m = subprocess.run([pack_vpk, "-s", sfo_path, "-b", eboot_path, "-m", "-", vpk_m_path],
+                               input=manifest, capture_output=True, text=True)
+        if res_m.returncode != 0:
+            print("Failed to run vita-pack-vpk -m -:", res_m.stderr)
+            sys.exit(1)
+        with open(vpk_path, "rb") as f1, open(vpk_m_path, "rb") as f2:
+            assert f1.read() == f2.read(), "Manifest packing output differs from -a output"
+
+        # --reproducible ignores mtimes, time zones and thread counts
+        vpk_r1_path = os.path.join(tmpdir, "test_r1.vpk")
+        vpk_r2_path = os.path.join(tmpdir, "test_r2.vpk")
+        res_r = subprocess.run(cmd[:-1] + ["-r", vpk_r1_path], capture_output=True, text=True,
+                               env=dict(os.environ, TZ="UTC"))
+        assert res_r.returncode == 0, res_r.stderr
+        os.utime(eboot_path, (1000000000, 1000000000))
+        res_r = subprocess.run(cmd[:-1] + ["-r", "-j", "3", vpk_r2_path], capture_output=True, text=True,
+                               env=dict(os.environ, TZ="America/New_York"))
+        assert res_r.returncode == 0, res_r.stderr
+        with open(vpk_r1_path, "rb") as f1, open(vpk_r2_path, "rb") as f2:
+            assert f1.read() == f2.read(), "Reproducible packing output differs between runs"
+        with zipfile.ZipFile(vpk_r1_path, "r") as z:
+            assert all(i.date_time == (1980, 1, 1, 0, 0, 0) for i in z.infolist())
+
+        # Compression policy: known formats and --store globs are stored,
+        # compressible data is deflated
+        text_file = os.path.join(extra_dir, "script.txt")
+        with open(text_file, "wb") as f:
+            f.write(b"print('hello')\n" * 512)
+        vpk_store_path = os.path.join(tmpdir, "test_store.vpk")
+        res_s = subprocess.run(cmd[:-1] + ["--store=config.*", vpk_store_path], capture_output=True, text=True)
+        if res_s.returncode != 0:
+            print("Failed to run vita-pack-vpk --store:", res_s.stderr)
+            sys.exit(1)
+        with zipfile.ZipFile(vpk_store_path, "r") as z:
+            assert z.getinfo("sce_sys/icon0.png").compress_type == zipfile.ZIP_STORED
+            assert z.getinfo("assets/config.txt").compress_type == zipfile.ZIP_STORED
+            assert z.getinfo("assets/script.txt").compress_type == zipfile.ZIP_DEFLATED
+            assert z.read("assets/script.txt") == b"print('hello')\n" * 512
+            assert z.testzip() is None
+
+        # --update rewrites changed entries and drops removed files
+        with open(vpk_store_path, "rb") as f:
+            before = f.read()
+        update_cmd = cmd[:-1] + ["--store=config.*", "-u", vpk_store_path]
+        res_u = subprocess.run(update_cmd, capture_output=True, text=True)
+        assert res_u.returncode == 0, res_u.stderr
+        with open(vpk_store_path, "rb") as f:
+            assert f.read() == before, "Update without changes rewrote the archive"
+        with open(extra_file, "wb") as f:
+            f.write(b"NEW_CONFIG_DATA")
+        os.remove(text_file)
+        res_u = subprocess.run(update_cmd, capture_output=True, text=True)
+        assert res_u.returncode == 0, res_u.stderr
+        with zipfile.ZipFile(vpk_store_path, "r") as z:
+            assert "assets/script.txt" not in z.namelist()
+            assert z.read("assets/config.txt") == b"NEW_CONFIG_DATA"
+            assert z.read("eboot.bin") == b"MOCK_EBOOT_DATA"
+            assert z.testzip() is None
+
+        # More entries than the -j compression window hold go through libzip,
+        # whatever order it stats the sources in
+        many_dir = os.path.join(tmpdir, "many")
+        os.makedirs(many_dir, exist_ok=True)
+        for n in range(40):
+            with open(os.path.join(many_dir, f"file{n:02d}.txt"), "wb") as f:
+                f.write(b"entry %d\n" % n * 1000)
+        vpk_many_path = os.path.join(tmpdir, "test_many.vpk")
+        res_many = subprocess.run(cmd[:-1] + ["-a", f"{many_dir}=many", "-j", "2", vpk_many_path],
+                                  capture_output=True, text=True, timeout=60)
+        assert res_many.returncode == 0, res_many.stderr
+        with zipfile.ZipFile(vpk_many_path, "r") as z:
+            assert z.testzip() is None
+            for n in range(40):
+                info = z.getinfo(f"many/file{n:02d}.txt")
+                assert info.compress_type == zipfile.ZIP_DEFLATED
+                assert z.read(info) == b"entry %d\n" % n * 1000
+
+        # Files too large to buffer are deflated as they are written
+        large_dir = os.path.join(tmpdir, "large")
+        os.makedirs(large_dir, exist_ok=True)
+        large_data = b"".join(b"level %d\n" % i for i in range(2500000))
+        with open(os.path.join(large_dir, "level.dat"), "wb") as f:
+            f.write(large_data)
+        for flags in ([], ["-w", "-j", "2"]):
+            vpk_large_path = os.path.join(tmpdir, "test_large.vpk")
+            res_l = subprocess.run(cmd[:-1] + ["-a", f"{large_dir}=large"] + flags + [vpk_large_path],
+                                   capture_output=True, text=True)
+            assert res_l.returncode == 0, res_l.stderr
+            with zipfile.ZipFile(vpk_large_path, "r") as z:
+                info = z.getinfo("large/level.dat")
+                assert info.compress_type == zipfile.ZIP_DEFLATED
+                assert info.compress_size < len(large_data)
+                assert z.read("large/level.dat") == large_data
+                assert z.testzip() is None
+
+        # A nested tree is scanned on every -j thread and packs the same
+        # archive; a bad file deep inside it names its -a source
+        tree_dir = os.path.join(tmpdir, "tree")
+        for d in range(6):
+            for sub in range(4):
+                sub_dir = os.path.join(tree_dir, f"d{d}", f"s{sub}")
+                os.makedirs(sub_dir, exist_ok=True)
+                for n in range(5):
+                    with open(os.path.join(sub_dir, f"f{n}.txt"), "wb") as f:
+                        f.write(b"%d/%d/%d\n" % (d, sub, n) * 64)
+        tree_cmd = [pack_vpk, "-s", sfo_path, "-b", eboot_path, "-a", f"{tree_dir}=tree"]
+        vpk_t1_path = os.path.join(tmpdir, "test_t1.vpk")
+        vpk_t8_path = os.path.join(tmpdir, "test_t8.vpk")
+        res_t = subprocess.run(tree_cmd + [vpk_t1_path], capture_output=True, text=True)
+        assert res_t.returncode == 0, res_t.stderr
+        res_t = subprocess.run(tree_cmd + ["-j", "8", vpk_t8_path], capture_output=True, text=True)
+        assert res_t.returncode == 0, res_t.stderr
+        with open(vpk_t1_path, "rb") as f1, open(vpk_t8_path, "rb") as f2:
+            assert f1.read() == f2.read(), "Parallel tree scan output differs from serial output"
+        with zipfile.ZipFile(vpk_t8_path, "r") as z:
+            assert len(z.namelist()) == 2 + 6 * 4 * 5
+            assert z.read("tree/d5/s3/f4.txt") == b"5/3/4\n" * 64
+        os.symlink(os.path.join(tmpdir, "missing"), os.path.join(tree_dir, "d3", "s1", "dangling"))
+        res_t = subprocess.run(tree_cmd + ["-j", "8", vpk_t8_path], capture_output=True, text=True)
+        assert res_t.returncode != 0
+        assert "Error: cannot stat" in res_t.stderr and "dangling" in res_t.stderr, res_t.stderr
+        assert f"Error: failed to add additional file '{tree_dir}' as 'tree'" in res_t.stderr, res_t.stderr
+
         # Test 2: Error reporting on missing -a file (Issue #287)
         nonexistent = os.path.join(tmpdir, "does_not_exist.bin")
         vpk_fail = os.path.join(tmpdir, "fail.vpk")